@@ -53,7 +53,7 @@ void ReferenceProfileView::timerCallback()
 ReferenceToneMatcherAudioProcessorEditor::ReferenceToneMatcherAudioProcessorEditor (ReferenceToneMatcherAudioProcessor& p)
     : AudioProcessorEditor (&p), processor (p), profileView (p)
 {
-    setSize (940, 540);
+    setSize (940, 570);
     setResizable (false, false);
 
     profileLabel.setJustificationType (juce::Justification::centredLeft);
@@ -62,16 +62,30 @@ ReferenceToneMatcherAudioProcessorEditor::ReferenceToneMatcherAudioProcessorEdit
 
     loadButton.onClick = [this]
     {
-        juce::FileChooser chooser ("Referenzdatei wählen", juce::File(), "*.wav;*.flac;*.mp3");
-        if (chooser.browseForFileToOpen())
+        if (processor.isAnalysingReference())
         {
-            auto result = chooser.getResult();
-            if (processor.analyseReferenceFile (result))
-                updateProfileLabel();
+            processor.cancelReferenceAnalysis();
+            return;
         }
+
+        juce::FileChooser chooser ("Referenzdatei wählen", juce::File(), "*.wav;*.flac;*.mp3");
+        if (chooser.browseForFileToOpen())
+            processor.analyseReferenceFileAsync (chooser.getResult());
     };
     addAndMakeVisible (loadButton);
 
+    libraryButton.onClick = [this]
+    {
+        juce::FileChooser chooser ("Referenzbibliothek wählen", juce::File(), "*.rtpi");
+        if (chooser.browseForFileToOpen())
+            processor.loadReferenceLibraryAsync (chooser.getResult());
+    };
+    addAndMakeVisible (libraryButton);
+
+    suggestionLabel.setJustificationType (juce::Justification::centredLeft);
+    suggestionLabel.setColour (juce::Label::textColourId, juce::Colours::white.withAlpha (0.7f));
+    addAndMakeVisible (suggestionLabel);
+
     auto& state = processor.getValueTreeState();
 
     for (size_t i = 0; i < bandSliders.size(); ++i)
@@ -116,6 +130,7 @@ ReferenceToneMatcherAudioProcessorEditor::ReferenceToneMatcherAudioProcessorEdit
     addAndMakeVisible (profileView);
 
     updateProfileLabel();
+    startTimerHz (15);
 }
 
 ReferenceToneMatcherAudioProcessorEditor::~ReferenceToneMatcherAudioProcessorEditor() = default;
@@ -135,10 +150,12 @@ void ReferenceToneMatcherAudioProcessorEditor::resized()
     auto bounds = getLocalBounds();
     auto header = bounds.removeFromTop (60);
     loadButton.setBounds (header.removeFromRight (200).reduced (20, 15));
-    profileLabel.setBounds (header.reduced (200, 15));
+    libraryButton.setBounds (header.removeFromRight (180).reduced (0, 15));
+    profileLabel.setBounds (header.withTrimmedLeft (260).reduced (0, 15));
 
     auto profileArea = bounds.removeFromTop (140).reduced (20, 10);
     profileView.setBounds (profileArea);
+    suggestionLabel.setBounds (bounds.removeFromTop (30).reduced (20, 0));
 
     auto sliderArea = bounds.removeFromTop (220).reduced (20, 10);
     const int sliderWidth = sliderArea.getWidth() / static_cast<int> (bandSliders.size());
@@ -170,6 +187,40 @@ void ReferenceToneMatcherAudioProcessorEditor::configureSlider (juce::Slider& sl
     slider.setTextValueSuffix (suffix);
 }
 
+void ReferenceToneMatcherAudioProcessorEditor::timerCallback()
+{
+    const bool analysing = processor.isAnalysingReference();
+
+    if (analysing)
+    {
+        const int percent = juce::roundToInt (processor.getAnalysisProgress() * 100.0f);
+        profileLabel.setText ("Analysiere Referenz: " + juce::String (percent) + " %", juce::dontSendNotification);
+    }
+    else if (wasAnalysing)
+    {
+        updateProfileLabel();
+        requestSuggestions();
+    }
+
+    if (processor.getReferenceLibraryRevision() != lastLibraryRevision)
+    {
+        lastLibraryRevision = processor.getReferenceLibraryRevision();
+        requestSuggestions();
+    }
+
+    // The mix profile keeps moving, so refresh the suggestions every two seconds.
+    if (--ticksUntilSuggestionRefresh <= 0)
+    {
+        ticksUntilSuggestionRefresh = 30;
+        requestSuggestions();
+    }
+
+    if (analysing != wasAnalysing)
+        loadButton.setButtonText (analysing ? "Abbrechen" : "Referenz laden");
+
+    wasAnalysing = analysing;
+}
+
 void ReferenceToneMatcherAudioProcessorEditor::updateProfileLabel()
 {
     auto profile = processor.getCurrentProfile();
@@ -179,3 +230,30 @@ void ReferenceToneMatcherAudioProcessorEditor::updateProfileLabel()
         profileLabel.setText ("Profil geladen: keines", juce::dontSendNotification);
 }
 
+void ReferenceToneMatcherAudioProcessorEditor::requestSuggestions()
+{
+    // Prefer the live mix; fall back to the loaded reference until audio has been seen.
+    auto profile = processor.getMixProfile();
+    if (! profile.isValid)
+        profile = processor.getCurrentProfile();
+
+    if (! profile.isValid || processor.getReferenceLibrarySize() == 0)
+        return;
+
+    juce::Component::SafePointer<ReferenceToneMatcherAudioProcessorEditor> safeThis (this);
+    processor.findClosestReferencesAsync (profile, 3, [safeThis] (const auto& suggestions)
+    {
+        if (safeThis != nullptr)
+            safeThis->showSuggestions (suggestions);
+    });
+}
+
+void ReferenceToneMatcherAudioProcessorEditor::showSuggestions (const std::vector<ReferenceToneMatcherAudioProcessor::ReferenceSuggestion>& suggestions)
+{
+    juce::StringArray names;
+    for (const auto& suggestion : suggestions)
+        names.add (juce::File (suggestion.path).getFileNameWithoutExtension());
+
+    suggestionLabel.setText (names.isEmpty() ? juce::String() : "Ähnliche Referenzen: " + names.joinIntoString (", "),
+                             juce::dontSendNotification);
+}
@@ -27,7 +27,8 @@ private:
     Provides the graphical user interface for the ReferenceToneMatcher plug-in.
     It displays the analysis controls, EQ bands and enhancement parameters.
 */
-class ReferenceToneMatcherAudioProcessorEditor  : public juce::AudioProcessorEditor
+class ReferenceToneMatcherAudioProcessorEditor  : public juce::AudioProcessorEditor,
+                                                  private juce::Timer
 {
 public:
     explicit ReferenceToneMatcherAudioProcessorEditor (ReferenceToneMatcherAudioProcessor&);
@@ -39,11 +40,20 @@ public:
 private:
     void configureSlider (juce::Slider& slider, juce::Slider::SliderStyle style, const juce::String& suffix = {});
     void updateProfileLabel();
+    void timerCallback() override;
+    void requestSuggestions();
+    void showSuggestions (const std::vector<ReferenceToneMatcherAudioProcessor::ReferenceSuggestion>& suggestions);
 
     ReferenceToneMatcherAudioProcessor& processor;
 
     juce::TextButton loadButton { "Referenz laden" };
     juce::Label profileLabel;
+    bool wasAnalysing = false;
+
+    juce::TextButton libraryButton { "Bibliothek laden" };
+    juce::Label suggestionLabel;
+    int lastLibraryRevision = 0;
+    int ticksUntilSuggestionRefresh = 0;
 
     std::array<juce::Slider, 16> bandSliders;
     std::array<std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment>, 16> bandAttachments;
@@ -6,15 +6,37 @@
 ReferenceToneMatcherAudioProcessor::ReferenceToneMatcherAudioProcessor()
     : AudioProcessor (BusesProperties()
                          .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
-                         .withOutput ("Output", juce::AudioChannelSet::stereo(), true)),
-      parameters (*this, nullptr, "ReferenceToneMatcherParameters", createParameterLayout())
+                         .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
+                         .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)),
+      parameters (*this, nullptr, "ReferenceToneMatcherParameters", createParameterLayout()),
+      currentProfile (std::make_shared<const reference_tone_matcher::ReferenceProfile>()),
+      searchIndex (std::make_shared<const reference_tone_matcher::ProfileSearchIndex>())
 {
     parameters.state.addListener (this);
-    lastEqValues.fill (0.0f);
+
+    for (size_t band = 0; band < bandGainParameters.size(); ++band)
+        bandGainParameters[band] = parameters.getRawParameterValue ("band" + juce::String (static_cast<int> (band + 1)));
+
+    sidechainMatchParameter = parameters.getRawParameterValue ("sidechainMatch");
+    linearPhaseParameter = parameters.getRawParameterValue ("linearPhase");
+    exciterQualityParameter = parameters.getRawParameterValue ("exciterQuality");
+    exciterAntiAliasingParameter = parameters.getRawParameterValue ("exciterAntiAliasing");
+    lowLatencyParameter = parameters.getRawParameterValue ("lowLatency");
+    wetParameter = parameters.getRawParameterValue ("wet");
+    crispParameter = parameters.getRawParameterValue ("crispAmount");
+    sparkleParameter = parameters.getRawParameterValue ("sparkle");
+    biteParameter = parameters.getRawParameterValue ("bite");
+    transientLinkParameter = parameters.getRawParameterValue ("transientLink");
+    glueParameter = parameters.getRawParameterValue ("glue");
+    dynamicsBandsParameter = parameters.getRawParameterValue ("dynamicsBands");
+    profileCrossoversParameter = parameters.getRawParameterValue ("profileCrossovers");
+    dynamicsLookaheadParameter = parameters.getRawParameterValue ("dynamicsLookahead");
 }
 
 ReferenceToneMatcherAudioProcessor::~ReferenceToneMatcherAudioProcessor()
 {
+    analysisPool.removeAllJobs (true, 5000);
+    searchPool.removeAllJobs (true, 5000);
     parameters.state.removeListener (this);
 }
 
@@ -37,35 +59,49 @@ void ReferenceToneMatcherAudioProcessor::changeProgramName (int, const juce::Str
 void ReferenceToneMatcherAudioProcessor::prepareToPlay (double newSampleRate, int samplesPerBlock)
 {
     sampleRate = static_cast<float> (newSampleRate);
+    matchGainsDb.fill (0.0f);
+    sidechainMatchActive = false;
+    lastSidechainHop = 0;
+    samplesSinceSidechainActivity = std::numeric_limits<int>::max();
 
-    juce::dsp::ProcessSpec spec { newSampleRate, static_cast<juce::uint32> (samplesPerBlock), static_cast<juce::uint32> (getTotalNumOutputChannels()) };
-    eqDesigner.prepare (spec);
-    transientDesigner.prepare (spec);
-    exciter.prepare (spec);
-    dynamics.prepare (spec);
-
-    updateWetDryBufferSize (samplesPerBlock);
+    // Every module is prepared for one tile, which keeps all of their scratch buffers cache-sized.
     updateProcessingFromParameters();
+    chain.prepare (newSampleRate, samplesPerBlock, getTotalNumOutputChannels());
+    mixProfiler.prepare (newSampleRate);
+    sidechainProfiler.prepare (newSampleRate);
+
+    processingLatency.store (chain.getLatencySamples());
+    setLatencySamples (processingLatency.load());
 }
 
 void ReferenceToneMatcherAudioProcessor::releaseResources()
 {
-    eqDesigner.reset();
-    transientDesigner.reset();
-    exciter.reset();
-    dynamics.reset();
+    chain.reset();
+    chain.release();
+    mixProfiler.release();
+    sidechainProfiler.release();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
 bool ReferenceToneMatcherAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-        && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // Every stage keeps its per-channel state in SIMD lanes, so any layout up to the limit works,
+    // surround and immersive formats included, as long as input and output match.
+    const auto mainOutput = layouts.getMainOutputChannelSet();
+    if (mainOutput.isDisabled() || mainOutput.size() > maxMainChannels)
         return false;
 
-    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
+    if (mainOutput != layouts.getMainInputChannelSet())
         return false;
 
+    // The sidechain is downmixed for analysis, so it may use any layout.
+    if (layouts.inputBuses.size() > 1)
+    {
+        const auto sidechain = layouts.getChannelSet (true, 1);
+        if (sidechain.size() > maxMainChannels)
+            return false;
+    }
+
     return true;
 }
 #endif
@@ -75,37 +111,45 @@ void ReferenceToneMatcherAudioProcessor::processBlock (juce::AudioBuffer<float>&
     juce::ignoreUnused (midiMessages);
     juce::ScopedNoDenormals noDenormals;
 
-    const auto totalNumInputChannels  = getTotalNumInputChannels();
-    const auto totalNumOutputChannels = getTotalNumOutputChannels();
+    const auto totalNumInputChannels  = getMainBusNumInputChannels();
+    const auto totalNumOutputChannels = getMainBusNumOutputChannels();
+    const auto numSamples = buffer.getNumSamples();
 
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
-        buffer.clear (i, 0, buffer.getNumSamples());
-
-    updateProcessingFromParameters();
+        buffer.clear (i, 0, numSamples);
 
-    if (dryBuffer.getNumSamples() < buffer.getNumSamples())
-        updateWetDryBufferSize (buffer.getNumSamples());
+    mixProfiler.pushSamples (buffer, 0, totalNumInputChannels, numSamples);
 
-    for (int ch = 0; ch < totalNumOutputChannels; ++ch)
-        dryBuffer.copyFrom (ch, 0, buffer, ch, 0, buffer.getNumSamples());
-
-    juce::dsp::AudioBlock<float> block (buffer);
+    // The sidechain only feeds the analysis; it never reaches the output.
+    if (getBusCount (true) > 1 && getBus (true, 1)->isEnabled())
+    {
+        auto sidechain = getBusBuffer (buffer, true, 1);
+        sidechainProfiler.pushSamples (sidechain, 0, sidechain.getNumChannels(), numSamples);
+    }
+    else
+    {
+        // Repeated every block, so a hop still in flight when the bus went away is cleared too.
+        sidechainProfiler.clearPublishedLevels();
+    }
 
-    eqDesigner.process (block);
-    transientDesigner.process (block);
-    exciter.process (block);
-    dynamics.process (block);
+    updateSidechainMatching (numSamples);
+    updateProcessingFromParameters();
 
-    const float wet = *parameters.getRawParameterValue ("wet");
-    const float dry = 1.0f - wet;
+    // Offline renders may run faster than the design thread, so design on the render thread instead.
+    if (isNonRealtime())
+        chain.designPendingCoefficients();
 
-    for (int ch = 0; ch < totalNumOutputChannels; ++ch)
+    // The host is told about latency changes from the message thread.
+    const int latency = chain.getLatencySamples();
+    if (latency != processingLatency.load())
     {
-        auto* data = buffer.getWritePointer (ch);
-        const auto* dryData = dryBuffer.getReadPointer (ch);
-        for (int i = 0; i < buffer.getNumSamples(); ++i)
-            data[i] = dryData[i] * dry + data[i] * wet;
+        processingLatency.store (latency);
+        triggerAsyncUpdate();
     }
+
+    auto mainBuffer = getBusBuffer (buffer, false, 0);
+    auto block = juce::dsp::AudioBlock<float> (mainBuffer).getSubsetChannelBlock (0, static_cast<size_t> (totalNumOutputChannels));
+    chain.process (block);
 }
 
 bool ReferenceToneMatcherAudioProcessor::hasEditor() const { return true; }
@@ -130,20 +174,55 @@ void ReferenceToneMatcherAudioProcessor::setStateInformation (const void* data,
 
     if (tree.isValid())
     {
+        // processBlock picks the restored parameters up; the chain belongs to the audio thread.
         parameters.replaceState (tree);
-        updateProcessingFromParameters();
+
+        const juce::File libraryFile (parameters.state.getProperty ("libraryIndex").toString());
+        if (libraryFile.existsAsFile())
+            loadReferenceLibraryAsync (libraryFile);
     }
 }
 
-bool ReferenceToneMatcherAudioProcessor::analyseReferenceFile (const juce::File& file)
+void ReferenceToneMatcherAudioProcessor::analyseReferenceFileAsync (const juce::File& file)
 {
-    auto profile = analyser.analyseFile (file, sampleRate);
-    if (! profile.isValid)
-        return false;
+    cancelReferenceAnalysis();
+
+    analysisProgress.store (0.0f);
+    analysisRunning.store (true);
+
+    auto onProgress = [this] (float progress) { analysisProgress.store (progress); };
+    auto onComplete = [this] (const reference_tone_matcher::ReferenceProfile& profile)
+    {
+        if (profile.isValid)
+        {
+            std::atomic_store (&currentProfile, std::make_shared<const reference_tone_matcher::ReferenceProfile> (profile));
+            profileReady.store (true);
+            triggerAsyncUpdate();
+        }
 
-    currentProfile = profile;
-    profileReady.store (true);
+        analysisRunning.store (false);
+    };
+
+    analysisPool.addJob (new reference_tone_matcher::ReferenceAnalysisJob (file, sampleRate, onProgress, onComplete, &profileCache),
+                        true);
+}
+
+void ReferenceToneMatcherAudioProcessor::cancelReferenceAnalysis()
+{
+    analysisPool.removeAllJobs (true, 5000);
+    analysisRunning.store (false);
+}
+
+void ReferenceToneMatcherAudioProcessor::handleAsyncUpdate()
+{
+    if (profileReady.exchange (false))
+        applyProfileToParameters (*std::atomic_load (&currentProfile));
+
+    setLatencySamples (processingLatency.load());
+}
 
+void ReferenceToneMatcherAudioProcessor::applyProfileToParameters (const reference_tone_matcher::ReferenceProfile& profile)
+{
     for (size_t band = 0; band < profile.eqGainsDb.size(); ++band)
     {
         auto paramID = "band" + juce::String (static_cast<int> (band + 1));
@@ -166,50 +245,130 @@ bool ReferenceToneMatcherAudioProcessor::analyseReferenceFile (const juce::File&
     if (auto* crispParam = parameters.getParameter ("crispAmount"))
         crispParam->setValueNotifyingHost (crispParam->convertTo0to1 (profile.crispAmount));
 
-    return true;
+    chain.setReferenceProfile (profile);
 }
 
 reference_tone_matcher::ReferenceProfile ReferenceToneMatcherAudioProcessor::getCurrentProfile() const
 {
-    return currentProfile;
+    return *std::atomic_load (&currentProfile);
 }
 
-void ReferenceToneMatcherAudioProcessor::updateWetDryBufferSize (int samplesPerBlock)
+void ReferenceToneMatcherAudioProcessor::loadReferenceLibraryAsync (const juce::File& indexFile)
 {
-    dryBuffer.setSize (getTotalNumOutputChannels(), samplesPerBlock, false, false, true);
-    dryBuffer.clear();
+    parameters.state.setProperty ("libraryIndex", indexFile.getFullPathName(), nullptr);
+
+    searchPool.addJob ([this, indexFile]
+    {
+        reference_tone_matcher::ProfileIndex index;
+        if (! index.load (indexFile))
+            return;
+
+        std::atomic_store (&searchIndex, std::make_shared<const reference_tone_matcher::ProfileSearchIndex> (std::move (index)));
+        ++libraryRevision;
+    });
 }
 
-void ReferenceToneMatcherAudioProcessor::updateProcessingFromParameters()
+int ReferenceToneMatcherAudioProcessor::getReferenceLibrarySize() const
+{
+    return static_cast<int> (std::atomic_load (&searchIndex)->size());
+}
+
+void ReferenceToneMatcherAudioProcessor::findClosestReferencesAsync (const reference_tone_matcher::ReferenceProfile& query,
+                                                                     int maxResults,
+                                                                     SuggestionCallback callback)
 {
-    for (size_t i = 0; i < lastEqValues.size(); ++i)
+    searchPool.addJob ([this, query, maxResults, callback = std::move (callback)]
     {
-        const auto* valuePtr = parameters.getRawParameterValue ("band" + juce::String (static_cast<int> (i + 1)));
-        if (valuePtr == nullptr)
-            continue;
+        const auto index = std::atomic_load (&searchIndex);
 
-        const float gainDb = *valuePtr;
-        if (! juce::approximatelyEqual (gainDb, lastEqValues[i]))
-        {
-            eqDesigner.setBandGain (i, gainDb);
-            lastEqValues[i] = gainDb;
-        }
+        std::vector<ReferenceSuggestion> suggestions;
+        for (const auto& match : index->findNearest (query, maxResults))
+            suggestions.push_back ({ index->getEntries()[match.index].path, match.distance });
+
+        juce::MessageManager::callAsync ([callback, suggestions] { callback (suggestions); });
+    });
+}
+
+void ReferenceToneMatcherAudioProcessor::updateSidechainMatching (int numSamples) noexcept
+{
+    std::array<float, 16> sidechainLevelsDb{};
+    std::array<float, 16> mixLevelsDb{};
+
+    const auto sidechainHop = sidechainProfiler.getNumAnalysedHops();
+    if (sidechainHop != lastSidechainHop)
+    {
+        lastSidechainHop = sidechainHop;
+        if (sidechainProfiler.getLastHopRmsDb() > sidechainFloorDb)
+            samplesSinceSidechainActivity = 0;
+    }
+
+    if (samplesSinceSidechainActivity < std::numeric_limits<int>::max() - numSamples)
+        samplesSinceSidechainActivity += numSamples;
+
+    const bool wantsMatching = sidechainMatchParameter->load() >= 0.5f;
+
+    if (! wantsMatching)
+    {
+        sidechainMatchActive = false;
+        return;
     }
 
-    const float bite = *parameters.getRawParameterValue ("bite");
-    const float sparkle = *parameters.getRawParameterValue ("sparkle");
-    const float crisp = *parameters.getRawParameterValue ("crispAmount");
-    const float glueAmount = *parameters.getRawParameterValue ("glue");
+    // A silent or stopped reference leaves the profile decaying towards nothing, and matching
+    // against it would push the EQ towards the inverse of the mix. Hold the last gains instead.
+    const bool sidechainActive = samplesSinceSidechainActivity <= juce::roundToInt (sidechainHoldSeconds * sampleRate);
+    const bool canMatch = sidechainActive
+                       && sidechainProfiler.getBandLevelsDb (sidechainLevelsDb)
+                       && mixProfiler.getBandLevelsDb (mixLevelsDb);
+
+    if (! canMatch)
+        return;
+
+    // Both profiles are normalised to their mean level, so the difference is the tonal correction.
+    // A one-pole ramp with a 0.5 s time constant keeps the EQ moves smooth whatever the block size.
+    const float smoothing = sidechainMatchActive ? 1.0f - std::exp (-static_cast<float> (numSamples) / (0.5f * sampleRate))
+                                                 : 1.0f;
 
-    transientDesigner.setAmount (bite);
-    exciter.setAmounts (crisp, sparkle);
-    dynamics.setAmount (glueAmount);
+    for (size_t band = 0; band < matchGainsDb.size(); ++band)
+    {
+        const float target = juce::jlimit (-12.0f, 12.0f, sidechainLevelsDb[band] - mixLevelsDb[band]);
+        matchGainsDb[band] += smoothing * (target - matchGainsDb[band]);
+    }
+
+    sidechainMatchActive = true;
+}
+
+void ReferenceToneMatcherAudioProcessor::updateProcessingFromParameters()
+{
+    auto settings = chain.getSettings();
+
+    for (size_t i = 0; i < bandGainParameters.size(); ++i)
+        settings.bandGainsDb[i] = sidechainMatchActive ? matchGainsDb[i] : bandGainParameters[i]->load();
+
+    settings.linearPhase = linearPhaseParameter->load() >= 0.5f;
+    settings.lowLatency = lowLatencyParameter->load() >= 0.5f;
+    settings.wet = wetParameter->load();
+    settings.crisp = crispParameter->load();
+    settings.sparkle = sparkleParameter->load();
+
+    // The choice index is the oversampling order: 1x, 2x, 4x.
+    const int exciterOrder = juce::jlimit (0, 2, static_cast<int> (exciterQualityParameter->load()));
+    settings.exciterQuality = static_cast<reference_tone_matcher::Exciter::OversamplingFactor> (exciterOrder);
+    settings.exciterAntiAliasing = exciterAntiAliasingParameter->load() >= 0.5f;
+
+    settings.bite = biteParameter->load();
+    settings.transientLink = transientLinkParameter->load() >= 0.5f;
+    settings.glue = glueParameter->load();
+    settings.dynamicsBands = static_cast<int> (dynamicsBandsParameter->load());
+    settings.profileCrossovers = profileCrossoversParameter->load() >= 0.5f;
+    settings.dynamicsLookaheadMs = dynamicsLookaheadParameter->load();
+
+    chain.setSettings (settings);
 }
 
 juce::AudioProcessorValueTreeState::ParameterLayout ReferenceToneMatcherAudioProcessor::createParameterLayout()
 {
     std::vector<std::unique_ptr<juce::RangedAudioParameter>> params;
-    params.reserve (16 + 5);
+    params.reserve (16 + 14);
 
     for (int i = 0; i < 16; ++i)
     {
@@ -220,6 +379,12 @@ juce::AudioProcessorValueTreeState::ParameterLayout ReferenceToneMatcherAudioPro
                                                                       0.0f));
     }
 
+    params.push_back (std::make_unique<juce::AudioParameterBool> (juce::ParameterID { "sidechainMatch", 1 },
+                                                                  "Sidechain Match",
+                                                                  false));
+    params.push_back (std::make_unique<juce::AudioParameterBool> (juce::ParameterID { "linearPhase", 1 },
+                                                                  "Linear Phase",
+                                                                  false));
     params.push_back (std::make_unique<juce::AudioParameterFloat> (juce::ParameterID { "wet", 1 },
                                                                    "Wet",
                                                                    juce::NormalisableRange<float> (0.0f, 1.0f, 0.001f),
@@ -232,14 +397,39 @@ juce::AudioProcessorValueTreeState::ParameterLayout ReferenceToneMatcherAudioPro
                                                                    "Sparkle",
                                                                    juce::NormalisableRange<float> (0.0f, 1.0f, 0.001f),
                                                                    0.5f));
+    params.push_back (std::make_unique<juce::AudioParameterChoice> (juce::ParameterID { "exciterQuality", 1 },
+                                                                    "Exciter Quality",
+                                                                    juce::StringArray { "1x", "2x", "4x" },
+                                                                    2));
+    params.push_back (std::make_unique<juce::AudioParameterBool> (juce::ParameterID { "exciterAntiAliasing", 1 },
+                                                                  "Exciter Anti-Aliasing",
+                                                                  true));
+    params.push_back (std::make_unique<juce::AudioParameterBool> (juce::ParameterID { "lowLatency", 1 },
+                                                                  "Low Latency",
+                                                                  false));
     params.push_back (std::make_unique<juce::AudioParameterFloat> (juce::ParameterID { "bite", 1 },
                                                                    "Bite",
                                                                    juce::NormalisableRange<float> (0.0f, 1.0f, 0.001f),
                                                                    0.5f));
+    params.push_back (std::make_unique<juce::AudioParameterBool> (juce::ParameterID { "transientLink", 1 },
+                                                                  "Transient Stereo Link",
+                                                                  false));
     params.push_back (std::make_unique<juce::AudioParameterFloat> (juce::ParameterID { "glue", 1 },
                                                                    "Glue",
                                                                    juce::NormalisableRange<float> (0.0f, 1.0f, 0.001f),
                                                                    0.5f));
+    params.push_back (std::make_unique<juce::AudioParameterInt> (juce::ParameterID { "dynamicsBands", 1 },
+                                                                 "Dynamics Bands",
+                                                                 reference_tone_matcher::MultiBandDynamics::minBands,
+                                                                 reference_tone_matcher::MultiBandDynamics::maxBands,
+                                                                 reference_tone_matcher::MultiBandDynamics::defaultNumBands));
+    params.push_back (std::make_unique<juce::AudioParameterBool> (juce::ParameterID { "profileCrossovers", 1 },
+                                                                  "Crossovers From Profile",
+                                                                  false));
+    params.push_back (std::make_unique<juce::AudioParameterFloat> (juce::ParameterID { "dynamicsLookahead", 1 },
+                                                                   "Dynamics Lookahead",
+                                                                   juce::NormalisableRange<float> (0.0f, static_cast<float> (reference_tone_matcher::MultiBandDynamics::maximumLookaheadMs), 0.01f),
+                                                                   0.0f));
 
     return { params.begin(), params.end() };
 }
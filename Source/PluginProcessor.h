@@ -2,23 +2,31 @@
 
 #include <array>
 #include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <juce_audio_formats/juce_audio_formats.h>
 #include <juce_dsp/juce_dsp.h>
 
 #include "dsp/ReferenceProfile.h"
 #include "dsp/SpectrumAnalyser.h"
-#include "dsp/EQDesigner.h"
-#include "dsp/Exciter.h"
-#include "dsp/TransientDesigner.h"
-#include "dsp/MultiBandDynamics.h"
+#include "dsp/ReferenceAnalysisJob.h"
+#include "dsp/ProfileCache.h"
+#include "dsp/ProfileSearchIndex.h"
+#include "dsp/LiveProfiler.h"
+#include "dsp/ProcessingChain.h"
 
 /**
     ReferenceToneMatcherAudioProcessor orchestrates the DSP chain for the ReferenceToneMatcher plug-in.
     It manages parameter state, handles reference profile analysis and processes incoming audio blocks.
+    Reference files are analysed on a background thread; the finished profile is published atomically
+    and applied to the parameters on the message thread.
 */
 class ReferenceToneMatcherAudioProcessor  : public juce::AudioProcessor,
-                                            private juce::ValueTree::Listener
+                                            private juce::ValueTree::Listener,
+                                            private juce::AsyncUpdater
 {
 public:
     ReferenceToneMatcherAudioProcessor();
@@ -59,9 +67,32 @@ public:
 
     juce::AudioProcessorValueTreeState& getValueTreeState() noexcept { return parameters; }
 
-    bool analyseReferenceFile (const juce::File& file);
+    void analyseReferenceFileAsync (const juce::File& file);
+    void cancelReferenceAnalysis();
+    bool isAnalysingReference() const noexcept { return analysisRunning.load(); }
+    float getAnalysisProgress() const noexcept { return analysisProgress.load(); }
     reference_tone_matcher::ReferenceProfile getCurrentProfile() const;
 
+    /** Running profile of the audio entering processBlock, updated in the background. */
+    reference_tone_matcher::ReferenceProfile getMixProfile() const { return mixProfiler.getProfile(); }
+
+    /** A library reference returned by a nearest-reference search. */
+    struct ReferenceSuggestion
+    {
+        juce::String path;
+        float distance = 0.0f;
+    };
+
+    using SuggestionCallback = std::function<void (const std::vector<ReferenceSuggestion>&)>;
+
+    /** Loads an index written by ReferenceLibraryIndexer on a background thread. */
+    void loadReferenceLibraryAsync (const juce::File& indexFile);
+    int getReferenceLibrarySize() const;
+    int getReferenceLibraryRevision() const noexcept { return libraryRevision.load(); }
+
+    /** Searches the library off the audio thread; the callback is invoked on the message thread. */
+    void findClosestReferencesAsync (const reference_tone_matcher::ReferenceProfile& query, int maxResults, SuggestionCallback callback);
+
 private:
     //==============================================================================
     juce::AudioProcessorValueTreeState parameters;
@@ -72,21 +103,58 @@ private:
     void valueTreePropertyChanged (juce::ValueTree& treeWhosePropertyHasChanged,
                                    const juce::Identifier& property) override;
 
-    void updateWetDryBufferSize (int samplesPerBlock);
-
-    juce::AudioBuffer<float> dryBuffer;
-    std::array<float, 16> lastEqValues{};
-
-    reference_tone_matcher::SpectrumAnalyser analyser;
-    reference_tone_matcher::ReferenceProfile currentProfile;
-    reference_tone_matcher::EQDesigner eqDesigner;
-    reference_tone_matcher::TransientDesigner transientDesigner;
-    reference_tone_matcher::Exciter exciter;
-    reference_tone_matcher::MultiBandDynamics dynamics;
+    void updateSidechainMatching (int numSamples) noexcept;
+    void applyProfileToParameters (const reference_tone_matcher::ReferenceProfile& profile);
+    void handleAsyncUpdate() override;
+
+    static constexpr int maxMainChannels = 16;          // Up to 9.1.6 and third-order ambisonics.
+    std::atomic<int> processingLatency { 0 };   // Latency reported to the host.
+
+    // Resolved once so the audio thread never looks parameters up by name.
+    std::array<std::atomic<float>*, 16> bandGainParameters{};
+    std::atomic<float>* sidechainMatchParameter = nullptr;
+    std::atomic<float>* linearPhaseParameter = nullptr;
+    std::atomic<float>* exciterQualityParameter = nullptr;
+    std::atomic<float>* exciterAntiAliasingParameter = nullptr;
+    std::atomic<float>* lowLatencyParameter = nullptr;
+    std::atomic<float>* wetParameter = nullptr;
+    std::atomic<float>* crispParameter = nullptr;
+    std::atomic<float>* sparkleParameter = nullptr;
+    std::atomic<float>* biteParameter = nullptr;
+    std::atomic<float>* transientLinkParameter = nullptr;
+    std::atomic<float>* glueParameter = nullptr;
+    std::atomic<float>* dynamicsBandsParameter = nullptr;
+    std::atomic<float>* profileCrossoversParameter = nullptr;
+    std::atomic<float>* dynamicsLookaheadParameter = nullptr;
+
+    std::shared_ptr<const reference_tone_matcher::ReferenceProfile> currentProfile;
+    reference_tone_matcher::ProcessingChain chain;
+    reference_tone_matcher::LiveProfiler mixProfiler { "Mix profiler" };
+    reference_tone_matcher::LiveProfiler sidechainProfiler { "Sidechain profiler" };
+
+    // EQ gains derived from sidechain versus mix, smoothed per block on the audio thread.
+    std::array<float, 16> matchGainsDb{};
+    bool sidechainMatchActive = false;
+
+    // The sidechain counts as active while its hops stay above the floor; matching holds its
+    // gains once no such hop has arrived for the hold time, whether the signal went quiet or stopped.
+    static constexpr float sidechainFloorDb = -60.0f;
+    static constexpr float sidechainHoldSeconds = 1.0f;
+    juce::uint32 lastSidechainHop = 0;
+    int samplesSinceSidechainActivity = std::numeric_limits<int>::max();
 
     std::atomic<bool> profileReady { false };
+    std::atomic<bool> analysisRunning { false };
+    std::atomic<float> analysisProgress { 0.0f };
     float sampleRate = 44100.0f;
 
+    std::shared_ptr<const reference_tone_matcher::ProfileSearchIndex> searchIndex;
+    std::atomic<int> libraryRevision { 0 };
+
+    reference_tone_matcher::ProfileCache profileCache { reference_tone_matcher::ProfileCache::getDefaultCacheFile() };
+    juce::ThreadPool analysisPool { 1 };
+    juce::ThreadPool searchPool { 1 };
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReferenceToneMatcherAudioProcessor)
 };
 
@@ -0,0 +1,67 @@
+#include "AnalysisBandMap.h"
+
+#include <cmath>
+
+namespace reference_tone_matcher
+{
+    AnalysisBandMap::AnalysisBandMap (int fftSizeToUse, double sampleRateToUse)
+        : fftSize (fftSizeToUse), sampleRate (sampleRateToUse)
+    {
+        const auto edges = getBandEdgesHz();
+        const int spectrumSize = fftSize / 2;
+
+        for (size_t band = 0; band < static_cast<size_t> (numBands); ++band)
+        {
+            lowBin[band] = static_cast<int> (juce::jlimit (0.0, static_cast<double> (spectrumSize - 1), std::floor (edges[band] * fftSize / sampleRate)));
+            highBin[band] = static_cast<int> (juce::jlimit (0.0, static_cast<double> (spectrumSize - 1), std::ceil (edges[band + 1] * fftSize / sampleRate)));
+            inverseBinCount[band] = 1.0f / static_cast<float> (juce::jmax (1, highBin[band] - lowBin[band]));
+        }
+    }
+
+    std::array<double, AnalysisBandMap::numBands + 1> AnalysisBandMap::getBandEdgesHz()
+    {
+        std::array<double, numBands + 1> edges{};
+        const double ratio = std::pow (maxFrequency / minFrequency, 1.0 / static_cast<double> (numBands));
+        edges[0] = minFrequency;
+        for (size_t i = 1; i < edges.size(); ++i)
+            edges[i] = edges[i - 1] * ratio;
+
+        return edges;
+    }
+
+    float sumOfSquares (const float* data, int numValues) noexcept
+    {
+        using Vec = juce::dsp::SIMDRegister<float>;
+        constexpr int vecSize = static_cast<int> (Vec::SIMDNumElements);
+
+        float sum = 0.0f;
+        int i = 0;
+
+        for (; i < numValues && ! Vec::isSIMDAligned (data + i); ++i)
+            sum += data[i] * data[i];
+
+        auto vecSum = Vec::expand (0.0f);
+        for (; i + vecSize <= numValues; i += vecSize)
+        {
+            const auto values = Vec::fromRawArray (data + i);
+            vecSum += values * values;
+        }
+
+        sum += vecSum.sum();
+
+        for (; i < numValues; ++i)
+            sum += data[i] * data[i];
+
+        return sum;
+    }
+
+    void accumulateBandPowers (const AnalysisBandMap& map, const float* spectrum, float* bandPowers) noexcept
+    {
+        for (size_t band = 0; band < static_cast<size_t> (AnalysisBandMap::numBands); ++band)
+        {
+            const int numValues = 2 * (map.highBin[band] - map.lowBin[band]);
+            bandPowers[band] = numValues > 0 ? sumOfSquares (spectrum + 2 * map.lowBin[band], numValues) * map.inverseBinCount[band]
+                                             : 0.0f;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <juce_dsp/juce_dsp.h>
+
+namespace reference_tone_matcher
+{
+    /**
+        Maps the 16 logarithmic analysis bands (80 Hz to 16 kHz) onto the bins of a real-only FFT.
+        Build it once per FFT size and sample rate; accumulateBandPowers then only reads the table.
+    */
+    struct AnalysisBandMap
+    {
+        static constexpr int numBands = 16;
+        static constexpr double minFrequency = 80.0;
+        static constexpr double maxFrequency = 16000.0;
+
+        AnalysisBandMap() = default;
+        AnalysisBandMap (int fftSizeToUse, double sampleRateToUse);
+
+        /** Returns the 17 logarithmically spaced band edges in Hz. */
+        static std::array<double, numBands + 1> getBandEdgesHz();
+
+        int fftSize = 0;
+        double sampleRate = 0.0;
+        std::array<int, numBands> lowBin{};           // First bin of each band.
+        std::array<int, numBands> highBin{};          // One past the last bin of each band.
+        std::array<float, numBands> inverseBinCount{};
+    };
+
+    /** Returns the sum of squares of a contiguous range using SIMD registers for the aligned part. */
+    float sumOfSquares (const float* data, int numValues) noexcept;
+
+    /**
+        Writes the mean power of every band of an interleaved real-only FFT spectrum into bandPowers.
+        Each band covers a contiguous run of re/im pairs, so the power is one sum of squares per band.
+    */
+    void accumulateBandPowers (const AnalysisBandMap& map, const float* spectrum, float* bandPowers) noexcept;
+}
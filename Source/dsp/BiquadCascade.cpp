@@ -0,0 +1,160 @@
+#include "BiquadCascade.h"
+
+#include <algorithm>
+
+namespace reference_tone_matcher
+{
+    void BiquadCascade::prepare (int newNumChannels, int newMaximumBlockSize)
+    {
+        numChannels = juce::jmax (0, newNumChannels);
+        maximumBlockSize = juce::jmax (1, newMaximumBlockSize);
+
+        const auto numGroups = static_cast<size_t> ((numChannels + static_cast<int> (Vec::size()) - 1) / static_cast<int> (Vec::size()));
+        states1.assign (numGroups, SectionState{});
+        states2.assign (numGroups, SectionState{});
+        frames.assign (static_cast<size_t> (maximumBlockSize), Vec{});
+
+        reset();
+    }
+
+    void BiquadCascade::reset() noexcept
+    {
+        for (auto& state : states1)
+            state.fill (Vec::expand (0.0f));
+
+        for (auto& state : states2)
+            state.fill (Vec::expand (0.0f));
+    }
+
+    void BiquadCascade::setCoefficients (const BiquadCoefficients* sections, int newNumSections) noexcept
+    {
+        numSections = juce::jlimit (0, maxSections, newNumSections);
+        rampSamplesRemaining = 0;
+
+        for (size_t k = 0; k < static_cast<size_t> (numSections); ++k)
+        {
+            coefficients.b0[k] = Vec::expand (sections[k].b0);
+            coefficients.b1[k] = Vec::expand (sections[k].b1);
+            coefficients.b2[k] = Vec::expand (sections[k].b2);
+            coefficients.a1[k] = Vec::expand (sections[k].a1);
+            coefficients.a2[k] = Vec::expand (sections[k].a2);
+        }
+
+        targets = coefficients;
+    }
+
+    void BiquadCascade::rampToCoefficients (const BiquadCoefficients* sections, int rampLength) noexcept
+    {
+        if (rampLength <= 0)
+        {
+            setCoefficients (sections, numSections);
+            return;
+        }
+
+        const auto scale = Vec::expand (1.0f / static_cast<float> (rampLength));
+
+        for (size_t k = 0; k < static_cast<size_t> (numSections); ++k)
+        {
+            targets.b0[k] = Vec::expand (sections[k].b0);
+            targets.b1[k] = Vec::expand (sections[k].b1);
+            targets.b2[k] = Vec::expand (sections[k].b2);
+            targets.a1[k] = Vec::expand (sections[k].a1);
+            targets.a2[k] = Vec::expand (sections[k].a2);
+
+            increments.b0[k] = (targets.b0[k] - coefficients.b0[k]) * scale;
+            increments.b1[k] = (targets.b1[k] - coefficients.b1[k]) * scale;
+            increments.b2[k] = (targets.b2[k] - coefficients.b2[k]) * scale;
+            increments.a1[k] = (targets.a1[k] - coefficients.a1[k]) * scale;
+            increments.a2[k] = (targets.a2[k] - coefficients.a2[k]) * scale;
+        }
+
+        rampSamplesRemaining = rampLength;
+    }
+
+    void BiquadCascade::process (juce::dsp::AudioBlock<float>& block) noexcept
+    {
+        const int blockChannels = juce::jmin (numChannels, static_cast<int> (block.getNumChannels()));
+        const int numSamples = static_cast<int> (block.getNumSamples());
+        const int lanes = static_cast<int> (Vec::size());
+
+        if (numSections == 0 || blockChannels == 0)
+            return;
+
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
+        {
+            const int numFrames = juce::jmin (maximumBlockSize, numSamples - start);
+            const int numRampFrames = juce::jmin (rampSamplesRemaining, numFrames);
+            Coefficients ramped;
+
+            for (int firstChannel = 0; firstChannel < blockChannels; firstChannel += lanes)
+            {
+                const auto group = static_cast<size_t> (firstChannel / lanes);
+                const int numInGroup = juce::jmin (lanes, blockChannels - firstChannel);
+
+                SimdLanes::Channels channels{};
+                for (int lane = 0; lane < numInGroup; ++lane)
+                    channels[static_cast<size_t> (lane)] = block.getChannelPointer (static_cast<size_t> (firstChannel + lane)) + start;
+
+                SimdLanes::pack (channels, numFrames, frames.data());
+
+                // Every group ramps from the same coefficients, so all of them end on identical values.
+                if (numRampFrames > 0)
+                {
+                    ramped = coefficients;
+                    processFrames<true> (ramped, states1[group], states2[group], 0, numRampFrames);
+                }
+
+                if (numRampFrames < numFrames)
+                    processFrames<false> (numRampFrames > 0 ? targets : coefficients, states1[group], states2[group],
+                                          numRampFrames, numFrames - numRampFrames);
+
+                SimdLanes::unpack (frames.data(), channels, numFrames);
+            }
+
+            if (numRampFrames > 0)
+            {
+                // Keep the per-sample sums rather than recomputing them, so the output does not
+                // depend on how the host splits its blocks.
+                rampSamplesRemaining -= numRampFrames;
+                coefficients = rampSamplesRemaining == 0 ? targets : ramped;
+            }
+        }
+    }
+
+    template <bool ramping>
+    void BiquadCascade::processFrames (Coefficients& c, SectionState& state1, SectionState& state2, int startFrame, int numFrames) noexcept
+    {
+        const int sections = numSections;
+
+        // Work on local copies so the compiler can keep the state in registers across samples.
+        SectionState s1 = state1;
+        SectionState s2 = state2;
+
+        for (int i = startFrame; i < startFrame + numFrames; ++i)
+        {
+            Vec x = frames[static_cast<size_t> (i)];
+
+            for (size_t k = 0; k < static_cast<size_t> (sections); ++k)
+            {
+                if constexpr (ramping)
+                {
+                    c.b0[k] += increments.b0[k];
+                    c.b1[k] += increments.b1[k];
+                    c.b2[k] += increments.b2[k];
+                    c.a1[k] += increments.a1[k];
+                    c.a2[k] += increments.a2[k];
+                }
+
+                const Vec y = c.b0[k] * x + s1[k];
+                s1[k] = c.b1[k] * x - c.a1[k] * y + s2[k];
+                s2[k] = c.b2[k] * x - c.a2[k] * y;
+                x = y;
+            }
+
+            frames[static_cast<size_t> (i)] = x;
+        }
+
+        state1 = s1;
+        state2 = s2;
+    }
+}
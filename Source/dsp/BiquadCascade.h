@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <juce_dsp/juce_dsp.h>
+
+#include "BiquadCoefficients.h"
+#include "SimdLanes.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Runs a chain of second-order sections over every channel in a single pass per sample.
+
+        Channels are packed into the lanes of a SIMDRegister, so a stereo signal is filtered as one
+        vector, and larger layouts are handled in groups of SIMDRegister<float>::size() channels.
+        Coefficients are kept as structure-of-arrays with each value broadcast across the lanes, and
+        the transposed direct form II state of the whole chain is held in locals for the duration of
+        a block. All memory is allocated in prepare.
+
+        New coefficients can also be approached with a linear per-sample ramp. Every ramp point lies
+        on the segment between two stable sections, and the stability region of a normalised biquad
+        (|a2| < 1, |a1| < 1 + a2) is convex, so the cascade stays stable throughout.
+    */
+    class BiquadCascade
+    {
+    public:
+        using Vec = juce::dsp::SIMDRegister<float>;
+        static constexpr int maxSections = 16;
+
+        BiquadCascade() = default;
+
+        void prepare (int numChannels, int maximumBlockSize);
+        void reset() noexcept;
+
+        /** Replaces the coefficients of the first numSections sections. Sections beyond that are skipped. */
+        void setCoefficients (const BiquadCoefficients* sections, int numSections) noexcept;
+        int getNumSections() const noexcept { return numSections; }
+
+        /** Moves every section linearly to the given coefficients over rampLength samples.
+            The section count must not change during a ramp. */
+        void rampToCoefficients (const BiquadCoefficients* sections, int rampLength) noexcept;
+        bool isRamping() const noexcept { return rampSamplesRemaining > 0; }
+
+        void process (juce::dsp::AudioBlock<float>& block) noexcept;
+
+    private:
+        using SectionState = std::array<Vec, maxSections>;
+
+        /** Structure-of-arrays coefficients, each value repeated in every lane. */
+        struct Coefficients
+        {
+            SectionState b0{}, b1{}, b2{}, a1{}, a2{};
+        };
+
+        template <bool ramping>
+        void processFrames (Coefficients& c, SectionState& state1, SectionState& state2, int startFrame, int numFrames) noexcept;
+
+        Coefficients coefficients, targets, increments;
+        int numSections = 0;
+        int rampSamplesRemaining = 0;
+
+        int numChannels = 0;
+        int maximumBlockSize = 0;
+        std::vector<SectionState> states1, states2;     // One entry per channel group.
+        std::vector<Vec> frames;                        // One interleaved frame of a channel group per sample.
+    };
+}
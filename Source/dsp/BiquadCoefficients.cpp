@@ -0,0 +1,92 @@
+#include "BiquadCoefficients.h"
+
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <cmath>
+
+namespace reference_tone_matcher
+{
+    namespace
+    {
+        BiquadCoefficients normalise (double b0, double b1, double b2, double a0, double a1, double a2) noexcept
+        {
+            const double inverseA0 = 1.0 / a0;
+            return { static_cast<float> (b0 * inverseA0),
+                     static_cast<float> (b1 * inverseA0),
+                     static_cast<float> (b2 * inverseA0),
+                     static_cast<float> (a1 * inverseA0),
+                     static_cast<float> (a2 * inverseA0) };
+        }
+    }
+
+    BiquadCoefficients BiquadCoefficients::makePeak (double sampleRate, double frequency, double q, float gainDb) noexcept
+    {
+        const double a = std::sqrt (juce::jmax (0.0, static_cast<double> (juce::Decibels::decibelsToGain (gainDb))));
+        const double omega = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+        const double alpha = std::sin (omega) / (q * 2.0);
+        const double c2 = -2.0 * std::cos (omega);
+        const double alphaTimesA = alpha * a;
+        const double alphaOverA = alpha / a;
+
+        return normalise (1.0 + alphaTimesA, c2, 1.0 - alphaTimesA, 1.0 + alphaOverA, c2, 1.0 - alphaOverA);
+    }
+
+    BiquadCoefficients BiquadCoefficients::makeLowPass (double sampleRate, double frequency, double q) noexcept
+    {
+        const double n = 1.0 / std::tan (juce::MathConstants<double>::pi * frequency / sampleRate);
+        const double nSquared = n * n;
+        const double invQ = 1.0 / q;
+        const double c1 = 1.0 / (1.0 + invQ * n + nSquared);
+
+        // Same bilinear design as juce::dsp::IIR::Coefficients::makeLowPass, already divided by a0.
+        return { static_cast<float> (c1),
+                 static_cast<float> (c1 * 2.0),
+                 static_cast<float> (c1),
+                 static_cast<float> (c1 * 2.0 * (1.0 - nSquared)),
+                 static_cast<float> (c1 * (1.0 - invQ * n + nSquared)) };
+    }
+
+    BiquadCoefficients BiquadCoefficients::makeHighPass (double sampleRate, double frequency, double q) noexcept
+    {
+        const double n = std::tan (juce::MathConstants<double>::pi * frequency / sampleRate);
+        const double nSquared = n * n;
+        const double invQ = 1.0 / q;
+        const double c1 = 1.0 / (1.0 + invQ * n + nSquared);
+
+        // Same bilinear design as juce::dsp::IIR::Coefficients::makeHighPass, already divided by a0.
+        return { static_cast<float> (c1),
+                 static_cast<float> (c1 * -2.0),
+                 static_cast<float> (c1),
+                 static_cast<float> (c1 * 2.0 * (nSquared - 1.0)),
+                 static_cast<float> (c1 * (1.0 - invQ * n + nSquared)) };
+    }
+
+    BiquadCoefficients BiquadCoefficients::makeAllPass (double sampleRate, double frequency, double q) noexcept
+    {
+        const double n = 1.0 / std::tan (juce::MathConstants<double>::pi * frequency / sampleRate);
+        const double nSquared = n * n;
+        const double invQ = 1.0 / q;
+        const double c1 = 1.0 / (1.0 + invQ * n + nSquared);
+        const double a1 = c1 * 2.0 * (1.0 - nSquared);
+        const double a2 = c1 * (1.0 - invQ * n + nSquared);
+
+        // Same bilinear design as juce::dsp::IIR::Coefficients::makeAllPass: the numerator mirrors the denominator.
+        return { static_cast<float> (a2),
+                 static_cast<float> (a1),
+                 1.0f,
+                 static_cast<float> (a1),
+                 static_cast<float> (a2) };
+    }
+
+    float BiquadCoefficients::getMagnitudeSquared (float cosOmega, float sinOmega, float cos2Omega, float sin2Omega) const noexcept
+    {
+        const float numeratorRe = b0 + b1 * cosOmega + b2 * cos2Omega;
+        const float numeratorIm = b1 * sinOmega + b2 * sin2Omega;
+        const float denominatorRe = 1.0f + a1 * cosOmega + a2 * cos2Omega;
+        const float denominatorIm = a1 * sinOmega + a2 * sin2Omega;
+
+        return (numeratorRe * numeratorRe + numeratorIm * numeratorIm)
+             / juce::jmax (1.0e-20f, denominatorRe * denominatorRe + denominatorIm * denominatorIm);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+namespace reference_tone_matcher
+{
+    /**
+        Normalised second-order section coefficients (a0 == 1) in plain floats, so they can be
+        designed on one thread and copied to the audio thread without reference counting.
+    */
+    struct BiquadCoefficients
+    {
+        float b0 = 1.0f;
+        float b1 = 0.0f;
+        float b2 = 0.0f;
+        float a1 = 0.0f;
+        float a2 = 0.0f;
+
+        /** RBJ peaking filter, identical to juce::dsp::IIR::Coefficients::makePeakFilter. */
+        static BiquadCoefficients makePeak (double sampleRate, double frequency, double q, float gainDb) noexcept;
+
+        /** RBJ second-order low-pass. */
+        static BiquadCoefficients makeLowPass (double sampleRate, double frequency, double q) noexcept;
+
+        /** RBJ second-order high-pass. */
+        static BiquadCoefficients makeHighPass (double sampleRate, double frequency, double q) noexcept;
+
+        /** RBJ second-order all-pass. With q = 1 / sqrt (2) it matches the sum of a fourth-order
+            Linkwitz-Riley low-pass and high-pass at the same frequency. */
+        static BiquadCoefficients makeAllPass (double sampleRate, double frequency, double q) noexcept;
+
+        /** Squared magnitude response at the normalised frequency omega, given cos and sin of omega and 2 omega. */
+        float getMagnitudeSquared (float cosOmega, float sinOmega, float cos2Omega, float sin2Omega) const noexcept;
+    };
+}
@@ -0,0 +1,219 @@
+#include "CompressorBank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace reference_tone_matcher
+{
+    namespace
+    {
+        constexpr float decibelsPerOctave = 6.0205999f;     // 20 log10 (2).
+        constexpr float minimumLevel = 1.0e-20f;            // Keeps silence out of the denormal range.
+
+        // juce::dsp::BallisticsFilter time constant, expressed as the gain of a one-pole step.
+        float makeBallisticsGain (float timeMs, double sampleRate) noexcept
+        {
+            return static_cast<float> (1.0 - std::exp (-juce::MathConstants<double>::twoPi * 1000.0
+                                                       / (sampleRate * static_cast<double> (timeMs))));
+        }
+
+        /** log2 of a positive normal float: the exponent is read from the bits, the mantissa goes
+            through a quartic fit. Written without branches so that loops over it vectorise. */
+        inline float fastLog2 (float x) noexcept
+        {
+            std::uint32_t bits;
+            std::memcpy (&bits, &x, sizeof (bits));
+            const float exponent = static_cast<float> (static_cast<int> (bits >> 23) - 127);
+
+            bits = (bits & 0x007fffffu) | 0x3f800000u;
+            float mantissa;
+            std::memcpy (&mantissa, &bits, sizeof (mantissa));
+
+            const float t = mantissa - 1.0f;
+            return exponent + t * (1.4385479f + t * (-0.6780895f + t * (0.3236463f + t * -0.0842947f)));
+        }
+
+        /** 2 to the power of y: the integer part goes into the exponent bits, the fraction through a quartic fit. */
+        inline float fastExp2 (float y) noexcept
+        {
+            y = juce::jlimit (-126.0f, 126.0f, y);
+            const float whole = std::floor (y);
+            const float f = y - whole;
+
+            const std::uint32_t bits = static_cast<std::uint32_t> (static_cast<int> (whole) + 127) << 23;
+            float scale;
+            std::memcpy (&scale, &bits, sizeof (scale));
+
+            return scale * (1.0000073f + f * (0.6929313f + f * (0.2417103f + f * (0.0516669f + f * 0.0136765f))));
+        }
+    }
+
+    void CompressorBank::prepare (double newSampleRate, int newNumChannels, int newMaximumBlockSize, int maximumLookaheadSamples)
+    {
+        sampleRate = newSampleRate;
+        numChannels = juce::jmax (0, newNumChannels);
+        maximumBlockSize = juce::jmax (1, newMaximumBlockSize);
+        maximumLookahead = juce::jmax (0, maximumLookaheadSamples);
+        lookahead = juce::jmin (lookahead, maximumLookahead);
+
+        const auto lanes = static_cast<int> (Vec::size());
+        const auto numGroups = static_cast<size_t> ((maxBands * numChannels + lanes - 1) / lanes);
+
+        // Unused lanes stay neutral: no gain reduction and no make-up.
+        Settings neutral;
+        neutral.thresholdDb = Vec::expand (0.0f);
+        neutral.slope = Vec::expand (0.0f);
+        neutral.attack = Vec::expand (1.0f);
+        neutral.release = Vec::expand (1.0f);
+        neutral.makeUpDb = Vec::expand (0.0f);
+
+        settings.assign (numGroups, neutral);
+        gainReductions.assign (numGroups, Vec::expand (0.0f));
+        lookaheadHistory.assign (numGroups * static_cast<size_t> (maximumLookahead), Vec::expand (0.0f));
+        frames.assign (static_cast<size_t> (maximumBlockSize), Vec::expand (0.0f));
+        scratchFrames.assign (static_cast<size_t> (maximumBlockSize), Vec::expand (0.0f));
+
+        for (int band = 0; band < maxBands; ++band)
+            setBandParameters (band, 0.0f, 1.0f, 1.0f, 100.0f, 0.0f);
+
+        reset();
+    }
+
+    void CompressorBank::reset() noexcept
+    {
+        std::fill (gainReductions.begin(), gainReductions.end(), Vec::expand (0.0f));
+        std::fill (lookaheadHistory.begin(), lookaheadHistory.end(), Vec::expand (0.0f));
+        lookaheadPosition = 0;
+    }
+
+    void CompressorBank::setBandParameters (int band, float thresholdDb, float ratio, float attackMs, float releaseMs, float makeUpGainDb) noexcept
+    {
+        if (band < 0 || band >= maxBands)
+            return;
+
+        // Above the threshold the output level rises by 1 / ratio dB per dB, so the gain falls by the rest.
+        const float slope = 1.0f / juce::jmax (1.0f, ratio) - 1.0f;
+        const float safeReleaseMs = juce::jmax (0.001f, releaseMs);
+        const float attack = makeBallisticsGain (juce::jlimit (0.001f, safeReleaseMs, attackMs), sampleRate);
+        const float release = makeBallisticsGain (safeReleaseMs, sampleRate);
+
+        const auto lanes = static_cast<size_t> (Vec::size());
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const auto slot = static_cast<size_t> (band * numChannels + channel);
+            auto& slotSettings = settings[slot / lanes];
+            const auto lane = slot % lanes;
+
+            slotSettings.thresholdDb.set (lane, thresholdDb);
+            slotSettings.slope.set (lane, slope);
+            slotSettings.attack.set (lane, attack);
+            slotSettings.release.set (lane, release);
+            slotSettings.makeUpDb.set (lane, makeUpGainDb);
+        }
+    }
+
+    void CompressorBank::setLookahead (int numSamples) noexcept
+    {
+        numSamples = juce::jlimit (0, maximumLookahead, numSamples);
+
+        if (numSamples != lookahead)
+        {
+            lookahead = numSamples;
+            std::fill (lookaheadHistory.begin(), lookaheadHistory.end(), Vec::expand (0.0f));
+            lookaheadPosition = 0;
+        }
+    }
+
+    void CompressorBank::process (const juce::dsp::AudioBlock<float>* bands, int numBands) noexcept
+    {
+        numBands = juce::jlimit (0, maxBands, numBands);
+
+        if (numBands == 0 || numChannels == 0)
+            return;
+
+        const int numSamples = static_cast<int> (bands[0].getNumSamples());
+        const int blockChannels = juce::jmin (numChannels, static_cast<int> (bands[0].getNumChannels()));
+        const int numSlots = numBands * numChannels;
+        const int lanes = static_cast<int> (Vec::size());
+
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
+        {
+            const int numFrames = juce::jmin (maximumBlockSize, numSamples - start);
+
+            for (int firstSlot = 0; firstSlot < numSlots; firstSlot += lanes)
+            {
+                const int numInGroup = juce::jmin (lanes, numSlots - firstSlot);
+
+                // Slots of channels missing from the block stay unused, like the lanes past the last slot.
+                SimdLanes::Channels channels{};
+                for (int lane = 0; lane < numInGroup; ++lane)
+                {
+                    const int slot = firstSlot + lane;
+                    if (slot % numChannels < blockChannels)
+                        channels[static_cast<size_t> (lane)] = bands[slot / numChannels].getChannelPointer (static_cast<size_t> (slot % numChannels)) + start;
+                }
+
+                SimdLanes::pack (channels, numFrames, frames.data());
+                processFrames (static_cast<size_t> (firstSlot / lanes), numFrames);
+                SimdLanes::unpack (scratchFrames.data(), channels, numFrames);
+            }
+
+            // Every group's history advanced by the same amount.
+            if (lookahead > 0)
+                lookaheadPosition = numFrames >= lookahead ? 0 : (lookaheadPosition + numFrames) % lookahead;
+        }
+    }
+
+    void CompressorBank::processFrames (size_t group, int numFrames) noexcept
+    {
+        const auto& s = settings[group];
+        const auto frameCount = static_cast<size_t> (numFrames);
+        const auto numValues = frameCount * Vec::size();
+        const auto* input = reinterpret_cast<const float*> (frames.data());
+        auto* scratch = reinterpret_cast<float*> (scratchFrames.data());
+
+        // Level detection in dB.
+        for (size_t i = 0; i < numValues; ++i)
+            scratch[i] = decibelsPerOctave * fastLog2 (juce::jmax (minimumLevel, std::abs (input[i])));
+
+        // Static curve and ballistics on the gain reduction. The smoothing is recursive, so this
+        // pass is only vectorised across lanes. The attack is never slower than the release, so
+        // the smaller step is the release when recovering and the attack when reducing further.
+        const auto zero = Vec::expand (0.0f);
+        auto reduction = gainReductions[group];
+
+        for (size_t i = 0; i < frameCount; ++i)
+        {
+            const auto target = Vec::min (zero, (scratchFrames[i] - s.thresholdDb) * s.slope);
+            const auto delta = target - reduction;
+            reduction += Vec::min (delta * s.attack, delta * s.release);
+            scratchFrames[i] = reduction + s.makeUpDb;
+        }
+
+        gainReductions[group] = reduction;
+
+        for (size_t i = 0; i < numValues; ++i)
+            scratch[i] = fastExp2 (scratch[i] * (1.0f / decibelsPerOctave));
+
+        // Apply the gain to the input delayed by the lookahead, then keep the newest inputs.
+        const auto delay = static_cast<size_t> (lookahead);
+        auto* history = lookaheadHistory.data() + group * static_cast<size_t> (maximumLookahead);
+        const auto numFromHistory = juce::jmin (delay, frameCount);
+        const auto position = static_cast<size_t> (lookaheadPosition);
+
+        for (size_t i = 0; i < numFromHistory; ++i)
+            scratchFrames[i] = history[(position + i) % delay] * scratchFrames[i];
+
+        for (size_t i = numFromHistory; i < frameCount; ++i)
+            scratchFrames[i] = frames[i - delay] * scratchFrames[i];
+
+        if (frameCount >= delay)
+            std::copy (frames.begin() + static_cast<std::ptrdiff_t> (frameCount - delay), frames.begin() + static_cast<std::ptrdiff_t> (frameCount), history);
+        else
+            for (size_t i = 0; i < frameCount; ++i)
+                history[(position + i) % delay] = frames[i];
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <juce_dsp/juce_dsp.h>
+
+#include "SimdLanes.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Peak compressors for up to maxBands band signals, computed block by block in vectorised passes.
+
+        Audio thread only; all memory is allocated in prepare. process() delays by the lookahead.
+    */
+    class CompressorBank
+    {
+    public:
+        using Vec = juce::dsp::SIMDRegister<float>;
+        static constexpr int maxBands = 6;
+
+        CompressorBank() = default;
+
+        void prepare (double sampleRate, int numChannels, int maximumBlockSize, int maximumLookaheadSamples);
+        void reset() noexcept;
+
+        /** Attack times longer than the release are shortened to the release time. */
+        void setBandParameters (int band, float thresholdDb, float ratio, float attackMs, float releaseMs, float makeUpGainDb) noexcept;
+
+        /** Changing the lookahead clears its history. */
+        void setLookahead (int numSamples) noexcept;
+        int getLookaheadSamples() const noexcept { return lookahead; }
+
+        /** Compresses the first numBands blocks in place. Each block holds one band for every channel. */
+        void process (const juce::dsp::AudioBlock<float>* bands, int numBands) noexcept;
+
+    private:
+        /** Per-slot settings, one value per lane. */
+        struct Settings
+        {
+            Vec thresholdDb, slope, attack, release, makeUpDb;
+        };
+
+        void processFrames (size_t group, int numFrames) noexcept;
+
+        double sampleRate = 44100.0;
+        int numChannels = 0;
+        int maximumBlockSize = 0;
+        int maximumLookahead = 0;
+        int lookahead = 0;
+        int lookaheadPosition = 0;                  // Oldest entry of every group's history.
+
+        std::vector<Settings> settings;             // One entry per slot group.
+        std::vector<Vec> gainReductions;            // Smoothed gain reduction in dB, per slot group.
+        std::vector<Vec> lookaheadHistory;          // maximumLookahead input frames per slot group.
+        std::vector<Vec> frames;                    // One interleaved input frame of a slot group per sample.
+        std::vector<Vec> scratchFrames;             // Levels, then gains, then the output of each frame.
+    };
+}
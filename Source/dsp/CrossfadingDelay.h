@@ -0,0 +1,89 @@
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+
+namespace reference_tone_matcher
+{
+    /**
+        Whole-sample delay line that crossfades from the old to the new delay over fadeSeconds
+        when the delay changes, so a latency change does not make the delayed signal jump.
+    */
+    class CrossfadingDelay
+    {
+    public:
+        static constexpr double fadeSeconds = 0.01;
+
+        void prepare (const juce::dsp::ProcessSpec& spec)
+        {
+            delayLine.prepare (spec);
+            fadeLength = juce::jmax (1, juce::roundToInt (spec.sampleRate * fadeSeconds));
+            fadeRemaining = 0;
+        }
+
+        void setMaximumDelayInSamples (int maximumDelay) { delayLine.setMaximumDelayInSamples (maximumDelay); }
+
+        void reset() noexcept
+        {
+            delayLine.reset();
+            fadeRemaining = 0;
+        }
+
+        /** Audio thread. A change fades out the delay heard so far; one during a fade restarts it. */
+        void setDelay (int newDelay) noexcept
+        {
+            if (newDelay == delay)
+                return;
+
+            previousDelay = delay;
+            delay = newDelay;
+            fadeRemaining = fadeLength;
+        }
+
+        void process (juce::dsp::AudioBlock<float>& block) noexcept
+        {
+            if (fadeRemaining == 0)
+            {
+                delayLine.setDelay (static_cast<float> (delay));
+                delayLine.process (juce::dsp::ProcessContextReplacing<float> (block));
+                return;
+            }
+
+            const auto numSamples = block.getNumSamples();
+            const auto numFadeSamples = static_cast<size_t> (juce::jmin (fadeRemaining, static_cast<int> (numSamples)));
+            const int fadeStart = fadeLength - fadeRemaining;
+
+            // Read both taps while fading; only the second one advances the read position.
+            for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+            {
+                const auto channel = static_cast<int> (ch);
+                float* samples = block.getChannelPointer (ch);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                {
+                    delayLine.pushSample (channel, samples[i]);
+
+                    if (i < numFadeSamples)
+                    {
+                        const float gain = static_cast<float> (fadeStart + static_cast<int> (i) + 1) / static_cast<float> (fadeLength);
+                        const float previous = delayLine.popSample (channel, static_cast<float> (previousDelay), false);
+                        const float current = delayLine.popSample (channel, static_cast<float> (delay), true);
+                        samples[i] = previous + gain * (current - previous);
+                    }
+                    else
+                    {
+                        samples[i] = delayLine.popSample (channel, static_cast<float> (delay), true);
+                    }
+                }
+            }
+
+            fadeRemaining -= static_cast<int> (numFadeSamples);
+        }
+
+    private:
+        juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> delayLine;
+        int delay = 0;
+        int previousDelay = 0;
+        int fadeLength = 1;
+        int fadeRemaining = 0;
+    };
+}
@@ -1,71 +1,447 @@
 #include "EQDesigner.h"
 
 #include <cmath>
+#include <limits>
 
 namespace reference_tone_matcher
 {
-    void EQDesigner::prepare (const juce::dsp::ProcessSpec& spec)
+    namespace
     {
-        currentSpec = spec;
-        isPrepared = true;
+        /** Samples until the impulse response of a section has decayed by 60 dB, from its slowest pole. */
+        double getSettlingSamples (const BiquadCoefficients& section) noexcept
+        {
+            const double a1 = section.a1;
+            const double a2 = section.a2;
+            const double discriminant = a1 * a1 - 4.0 * a2;
+            const double radius = discriminant < 0.0 ? std::sqrt (a2)
+                                                     : 0.5 * (std::abs (a1) + std::sqrt (discriminant));
+
+            if (radius <= 0.0)
+                return 0.0;
+
+            return radius < 1.0 ? std::log (1.0e-3) / std::log (radius) : std::numeric_limits<double>::max();
+        }
+    }
+
+    bool EQDesigner::CoefficientSet::hasSameLayout (const CoefficientSet& other) const noexcept
+    {
+        if (numSections != other.numSections)
+            return false;
 
+        for (size_t k = 0; k < static_cast<size_t> (numSections); ++k)
+            if (bandMasks[k] != other.bandMasks[k])
+                return false;
+
+        return true;
+    }
+
+    EQDesigner::EQDesigner()
+        : juce::Thread ("EQ designer")
+    {
         const double minFreq = 80.0;
         const double maxFreq = 16000.0;
         const double ratio = std::pow (maxFreq / minFreq, 1.0 / 15.0);
-        bandFrequencies[0] = static_cast<float> (minFreq);
+        bandFrequencies[0] = minFreq;
         for (size_t i = 1; i < bandFrequencies.size(); ++i)
-            bandFrequencies[i] = static_cast<float> (bandFrequencies[i - 1] * ratio);
+            bandFrequencies[i] = bandFrequencies[i - 1] * ratio;
+    }
 
-        for (auto& channelFilters : filters)
-            for (auto& filter : channelFilters)
-                filter.prepare (spec);
+    EQDesigner::~EQDesigner()
+    {
+        release();
+    }
+
+    void EQDesigner::prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        stopThread (1000);
 
+        currentSpec = spec;
+        isPrepared = true;
+
+        for (auto& cascade : cascades)
+            cascade.prepare (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
+
+        optimiser.prepare (spec.sampleRate);
+        rampLengthSamples = juce::jmax (1, juce::roundToInt (spec.sampleRate * rampTimeSeconds));
+
+        // Roughly 12 Hz bin spacing at any rate, which resolves the 80 Hz band.
+        const int firOrder = 12 + (spec.sampleRate > 50000.0 ? 1 : 0) + (spec.sampleRate > 100000.0 ? 1 : 0);
+        firLength = 1 << firOrder;
+        firFft = std::make_unique<juce::dsp::FFT> (firOrder);
+
+        const auto numBins = static_cast<size_t> (firLength / 2 + 1);
+        binCos1.resize (numBins);
+        binSin1.resize (numBins);
+        binCos2.resize (numBins);
+        binSin2.resize (numBins);
+        for (size_t bin = 0; bin < numBins; ++bin)
+        {
+            const double omega = juce::MathConstants<double>::twoPi * static_cast<double> (bin) / static_cast<double> (firLength);
+            binCos1[bin] = static_cast<float> (std::cos (omega));
+            binSin1[bin] = static_cast<float> (std::sin (omega));
+            binCos2[bin] = static_cast<float> (std::cos (2.0 * omega));
+            binSin2[bin] = static_cast<float> (std::sin (2.0 * omega));
+        }
+
+        // Hann window centred on the middle tap, so the impulse stays symmetric and w[0] drops the unpaired tap.
+        firWindow.resize (static_cast<size_t> (firLength));
+        for (size_t tap = 0; tap < firWindow.size(); ++tap)
+            firWindow[tap] = static_cast<float> (0.5 - 0.5 * std::cos (juce::MathConstants<double>::twoPi * static_cast<double> (tap)
+                                                                      / static_cast<double> (firLength)));
+
+        convolutions.clear();
+        for (juce::uint32 firstChannel = 0; firstChannel < spec.numChannels; firstChannel += 2)
+            convolutions.push_back (std::make_unique<juce::dsp::Convolution> (juce::dsp::Convolution::Latency { 0 }, convolutionQueue));
+
+        fadeBuffer.setSize (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
+
+        // Drop anything designed for the previous spec before designing for the new one.
+        coefficientMailbox.fetch();
+        designRequested.store (false);
+
+        currentCascade = 0;
+        cascadeDesign = designOptimisedCoefficients();
+        cascades[currentCascade].setCoefficients (cascadeDesign.bands.data(), cascadeDesign.numSections);
+
+        firIsCurrent = false;
+        fadeRemaining = 0;
+        activeEngine = 0;
+
+        // An impulse response loaded before Convolution::prepare is installed by it, so the FIR is
+        // live from the first block instead of some blocks later.
+        if (linearPhaseRequested.load())
+        {
+            loadLinearPhaseFir (designCoefficients());
+            activeEngine = convolutionEngine;
+        }
+
+        for (juce::uint32 firstChannel = 0; firstChannel < spec.numChannels; firstChannel += 2)
+        {
+            auto pairSpec = spec;
+            pairSpec.numChannels = juce::jmin (2u, spec.numChannels - firstChannel);
+            convolutions[firstChannel / 2]->prepare (pairSpec);
+        }
+
+        latencySamples.store (activeEngine == convolutionEngine ? getMaximumLatencySamples() : 0);
         reset();
+
+        startThread (juce::Thread::Priority::low);
+    }
+
+    void EQDesigner::release()
+    {
+        stopThread (1000);
     }
 
     void EQDesigner::reset() noexcept
     {
-        for (auto& channelFilters : filters)
-            for (auto& filter : channelFilters)
-                filter.reset();
+        for (auto& cascade : cascades)
+            cascade.reset();
+
+        resetConvolutions();
     }
 
-    void EQDesigner::setBandGain (size_t index, float gainDb)
+    void EQDesigner::resetConvolutions() noexcept
+    {
+        for (auto& convolution : convolutions)
+            convolution->reset();
+
+        primedSamples = 0;
+    }
+
+    void EQDesigner::setBandGain (size_t index, float gainDb) noexcept
     {
         if (index >= bandGainsDb.size())
             return;
 
-        bandGainsDb[index] = gainDb;
-        updateBandCoefficients (index);
+        if (bandGainsDb[index].exchange (gainDb) != gainDb)
+            requestDesign();
     }
 
-    void EQDesigner::process (juce::dsp::AudioBlock<float>& block) noexcept
+    void EQDesigner::setQFactor (float newQ) noexcept
+    {
+        if (qFactor.exchange (newQ) != newQ)
+            requestDesign();
+    }
+
+    void EQDesigner::setLinearPhase (bool shouldBeLinearPhase) noexcept
+    {
+        // The design thread builds the FIR when linear phase is requested and none is current.
+        if (linearPhaseRequested.exchange (shouldBeLinearPhase) != shouldBeLinearPhase)
+            notify();
+    }
+
+    void EQDesigner::requestDesign() noexcept
+    {
+        designRequested.store (true);
+        notify();
+    }
+
+    void EQDesigner::designPendingCoefficients()
     {
-        jassert (block.getNumChannels() <= filters.size());
+        const juce::ScopedLock sl (designLock);
+
         if (! isPrepared)
             return;
 
-        for (size_t ch = 0; ch < static_cast<size_t> (block.getNumChannels()); ++ch)
+        const bool wantsLinearPhase = linearPhaseRequested.load();
+
+        if (designRequested.exchange (false))
+        {
+            coefficientMailbox.publish (designOptimisedCoefficients());
+
+            // The FIR is built from the full design; its cost does not depend on the section count.
+            if (wantsLinearPhase)
+                loadLinearPhaseFir (designCoefficients());
+            else
+                firIsCurrent = false;
+        }
+        else if (wantsLinearPhase && ! firIsCurrent)
         {
-            auto channelBlock = block.getSingleChannelBlock (ch);
-            for (size_t band = 0; band < filters[ch].size(); ++band)
-                filters[ch][band].process (juce::dsp::ProcessContextReplacing<float> (channelBlock));
+            loadLinearPhaseFir (designCoefficients());
         }
     }
 
-    void EQDesigner::updateBandCoefficients (size_t band)
+    void EQDesigner::process (juce::dsp::AudioBlock<float>& block) noexcept
     {
-        if (! isPrepared || band >= bandFrequencies.size())
+        if (! isPrepared)
+            return;
+
+        // New designs are only picked up at ramp endpoints and never during a crossfade. The mailbox
+        // keeps the latest one, so fast automation costs one ramp setup per ramp length however often
+        // the gains move. A cascade that is not being heard takes new designs directly.
+        if (fadeRemaining == 0)
+        {
+            const bool cascadeAudible = activeEngine != convolutionEngine;
+            if (! cascadeAudible || ! cascades[currentCascade].isRamping())
+                if (const auto* designed = coefficientMailbox.fetch())
+                    acceptDesign (*designed, cascadeAudible);
+        }
+
+        // Linear-phase mode is only entered once the convolution has installed an impulse response
+        // and run on a full FIR length of input, so it fades in settled and its latency is real.
+        const bool wantsLinearPhase = linearPhaseRequested.load();
+        const bool convolutionRunning = activeEngine == convolutionEngine || (fadeRemaining > 0 && fadingEngine == convolutionEngine);
+
+        if (wantsLinearPhase && ! convolutionRunning)
+            primeConvolutions (block);
+
+        if (fadeRemaining == 0 && wantsLinearPhase != (activeEngine == convolutionEngine)
+            && (! wantsLinearPhase || (isFirInstalled() && primedSamples >= firLength)))
+        {
+            if (wantsLinearPhase)
+            {
+                startFade (convolutionEngine, rampLengthSamples);
+            }
+            else
+            {
+                cascades[currentCascade].reset();
+                startFade (static_cast<int> (currentCascade), cascadeDesign.settlingSamples);
+                primedSamples = 0;
+            }
+        }
+
+        latencySamples.store (activeEngine == convolutionEngine ? getMaximumLatencySamples() : 0);
+
+        if (fadeRemaining == 0)
+        {
+            processEngine (block, activeEngine);
             return;
+        }
+
+        // Run both engines while fading, the outgoing one on a copy of the input.
+        const auto numChannels = juce::jmin (block.getNumChannels(), static_cast<size_t> (fadeBuffer.getNumChannels()));
+        const auto maxChunk = static_cast<size_t> (fadeBuffer.getNumSamples());
+
+        for (size_t start = 0; start < block.getNumSamples(); start += maxChunk)
+        {
+            const auto numSamples = juce::jmin (maxChunk, block.getNumSamples() - start);
+            auto chunk = block.getSubBlock (start, numSamples);
+
+            if (fadeRemaining == 0)
+            {
+                processEngine (chunk, activeEngine);
+                continue;
+            }
+
+            juce::dsp::AudioBlock<float> outgoing (fadeBuffer.getArrayOfWritePointers(), numChannels, numSamples);
+            outgoing.copyFrom (chunk.getSubsetChannelBlock (0, numChannels));
+            processEngine (outgoing, fadingEngine);
+            processEngine (chunk, activeEngine);
+
+            const float step = 1.0f / static_cast<float> (fadeLength);
+            const float startGain = 1.0f - static_cast<float> (fadeRemaining) * step;
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+            {
+                float* incoming = chunk.getChannelPointer (ch);
+                const float* previous = outgoing.getChannelPointer (ch);
 
-        const auto frequency = static_cast<double> (bandFrequencies[band]);
-        const auto gainLinear = juce::Decibels::decibelsToGain (bandGainsDb[band]);
-        auto coefficients = juce::dsp::IIR::Coefficients<float>::makePeakFilter (currentSpec.sampleRate,
-                                                                                frequency,
-                                                                                qFactor,
-                                                                                gainLinear);
-        for (auto& channelFilters : filters)
-            channelFilters[band].coefficients = coefficients;
+                for (size_t i = 0; i < numSamples; ++i)
+                {
+                    const float gain = juce::jmin (1.0f, startGain + static_cast<float> (i + 1) * step);
+                    incoming[i] = previous[i] + gain * (incoming[i] - previous[i]);
+                }
+            }
+
+            fadeRemaining = juce::jmax (0, fadeRemaining - static_cast<int> (numSamples));
+        }
+    }
+
+    void EQDesigner::acceptDesign (const CoefficientSet& designed, bool cascadeAudible) noexcept
+    {
+        auto& cascade = cascades[currentCascade];
+
+        if (! cascadeAudible)
+        {
+            cascade.setCoefficients (designed.bands.data(), designed.numSections);
+        }
+        else if (designed.hasSameLayout (cascadeDesign))
+        {
+            cascade.rampToCoefficients (designed.bands.data(), rampLengthSamples);
+        }
+        else
+        {
+            // Different sections: start the other cascade from silence and crossfade to it once its
+            // start-up transient has died away. A 10 ms fade would let the ringing of low sections through.
+            currentCascade = 1 - currentCascade;
+            cascades[currentCascade].setCoefficients (designed.bands.data(), designed.numSections);
+            cascades[currentCascade].reset();
+            startFade (static_cast<int> (currentCascade), designed.settlingSamples);
+        }
+
+        cascadeDesign = designed;
+    }
+
+    void EQDesigner::startFade (int incomingEngine, int lengthSamples) noexcept
+    {
+        fadingEngine = activeEngine;
+        activeEngine = incomingEngine;
+        fadeLength = juce::jmax (rampLengthSamples, lengthSamples);
+        fadeRemaining = fadeLength;
+    }
+
+    void EQDesigner::processEngine (juce::dsp::AudioBlock<float>& block, int engine) noexcept
+    {
+        if (engine == convolutionEngine)
+        {
+            const auto numChannels = juce::jmin (block.getNumChannels(), 2 * convolutions.size());
+            for (size_t firstChannel = 0; firstChannel < numChannels; firstChannel += 2)
+            {
+                auto pair = block.getSubsetChannelBlock (firstChannel, juce::jmin (static_cast<size_t> (2), numChannels - firstChannel));
+                convolutions[firstChannel / 2]->process (juce::dsp::ProcessContextReplacing<float> (pair));
+            }
+        }
+        else
+            cascades[static_cast<size_t> (engine)].process (block);
+    }
+
+    void EQDesigner::primeConvolutions (const juce::dsp::AudioBlock<float>& block) noexcept
+    {
+        // The convolutions install pending impulse responses as they process, so they run on a copy.
+        const auto numChannels = juce::jmin (block.getNumChannels(), static_cast<size_t> (fadeBuffer.getNumChannels()));
+        const auto maxChunk = static_cast<size_t> (fadeBuffer.getNumSamples());
+
+        for (size_t start = 0; start < block.getNumSamples(); start += maxChunk)
+        {
+            const auto numSamples = juce::jmin (maxChunk, block.getNumSamples() - start);
+            juce::dsp::AudioBlock<float> copy (fadeBuffer.getArrayOfWritePointers(), numChannels, numSamples);
+            copy.copyFrom (block.getSubBlock (start, numSamples).getSubsetChannelBlock (0, numChannels));
+            processEngine (copy, convolutionEngine);
+        }
+
+        primedSamples = juce::jmin (firLength, primedSamples + static_cast<int> (block.getNumSamples()));
     }
-}
 
+    bool EQDesigner::isFirInstalled() const noexcept
+    {
+        // Until the first FIR is installed, the convolutions report the size of JUCE's placeholder impulse.
+        return ! convolutions.empty() && convolutions.front()->getCurrentIRSize() == firLength;
+    }
+
+    void EQDesigner::run()
+    {
+        // Sleeps until a setter asks for a new design; stopThread wakes it to exit.
+        while (! threadShouldExit())
+        {
+            designPendingCoefficients();
+            wait (-1);
+        }
+    }
+
+    EQDesigner::CoefficientSet EQDesigner::designCoefficients() const noexcept
+    {
+        CoefficientSet set;
+        const double q = static_cast<double> (qFactor.load());
+
+        for (size_t band = 0; band < numBands; ++band)
+        {
+            set.bands[band] = BiquadCoefficients::makePeak (currentSpec.sampleRate, bandFrequencies[band], q,
+                                                           bandGainsDb[band].load());
+            set.bandMasks[band] = 1u << band;
+        }
+
+        return set;
+    }
+
+    EQDesigner::CoefficientSet EQDesigner::designOptimisedCoefficients()
+    {
+        EQSectionOptimiser::SectionArray sections;
+        const double q = static_cast<double> (qFactor.load());
+
+        for (size_t band = 0; band < numBands; ++band)
+            sections[band] = { bandFrequencies[band], q, bandGainsDb[band].load(), 1u << band };
+
+        CoefficientSet set;
+        set.numSections = optimiser.optimise (sections, static_cast<int> (numBands));
+
+        double settlingSamples = 0.0;
+        for (size_t k = 0; k < static_cast<size_t> (set.numSections); ++k)
+        {
+            set.bands[k] = BiquadCoefficients::makePeak (currentSpec.sampleRate, sections[k].frequency, sections[k].q, sections[k].gainDb);
+            set.bandMasks[k] = sections[k].bandMask;
+            settlingSamples = juce::jmax (settlingSamples, getSettlingSamples (set.bands[k]));
+        }
+
+        set.settlingSamples = static_cast<int> (std::ceil (juce::jmin (settlingSamples, currentSpec.sampleRate * maxSettlingTimeSeconds)));
+        return set;
+    }
+
+    void EQDesigner::loadLinearPhaseFir (const CoefficientSet& set)
+    {
+        const auto numBins = static_cast<size_t> (firLength / 2 + 1);
+        std::vector<float> spectrum (static_cast<size_t> (2 * firLength), 0.0f);
+
+        // Zero-phase target: the magnitude response of the minimum-phase cascade at every bin.
+        for (size_t bin = 0; bin < numBins; ++bin)
+        {
+            float magnitudeSquared = 1.0f;
+
+            for (size_t k = 0; k < static_cast<size_t> (set.numSections); ++k)
+                magnitudeSquared *= set.bands[k].getMagnitudeSquared (binCos1[bin], binSin1[bin], binCos2[bin], binSin2[bin]);
+
+            spectrum[2 * bin] = std::sqrt (magnitudeSquared);
+        }
+
+        firFft->performRealOnlyInverseTransform (spectrum.data());
+
+        // Rotate the zero-phase response so its centre lands on the middle tap.
+        juce::AudioBuffer<float> impulse (1, firLength);
+        auto* taps = impulse.getWritePointer (0);
+        const auto half = static_cast<size_t> (firLength / 2);
+        for (size_t tap = 0; tap < static_cast<size_t> (firLength); ++tap)
+            taps[tap] = spectrum[(tap + half) % static_cast<size_t> (firLength)] * firWindow[tap];
+
+        // Every channel pair gets its own copy; the last one takes the original.
+        for (size_t k = 0; k < convolutions.size(); ++k)
+        {
+            auto response = k + 1 < convolutions.size() ? juce::AudioBuffer<float> (impulse) : std::move (impulse);
+            convolutions[k]->loadImpulseResponse (std::move (response), currentSpec.sampleRate,
+                                                  juce::dsp::Convolution::Stereo::no,
+                                                  juce::dsp::Convolution::Trim::no,
+                                                  juce::dsp::Convolution::Normalise::no);
+        }
+
+        firIsCurrent = true;
+    }
+}
@@ -1,33 +1,111 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include <juce_dsp/juce_dsp.h>
 
+#include "BiquadCascade.h"
+#include "BiquadCoefficients.h"
+#include "EQSectionOptimiser.h"
+#include "LatestValueMailbox.h"
+
 namespace reference_tone_matcher
 {
     /**
         Implements a 16 band peaking EQ that matches the spectral signature of the reference profile.
+
+        Gains may be set from any thread; coefficients are designed on a background thread, so
+        process() never allocates. In linear-phase mode process() delays by getLatencySamples().
     */
-    class EQDesigner
+    class EQDesigner  : private juce::Thread
     {
     public:
-        EQDesigner() = default;
+        static constexpr size_t numBands = 16;
+        static constexpr double rampTimeSeconds = 0.01;
+        static constexpr double maxSettlingTimeSeconds = 0.25;
+
+        /** Sections designed together for one set of gains. Each section covers the bands in its mask. */
+        struct CoefficientSet
+        {
+            std::array<BiquadCoefficients, numBands> bands{};
+            std::array<juce::uint32, numBands> bandMasks{};
+            int numSections = static_cast<int> (numBands);
+            int settlingSamples = 0;        // Until the slowest section's start-up transient is 60 dB down.
 
+            /** True if both sets have the same sections, so one can be ramped into the other. */
+            bool hasSameLayout (const CoefficientSet& other) const noexcept;
+        };
+
+        EQDesigner();
+        ~EQDesigner() override;
+
+        /** Designs the current gains for the new spec and starts the design thread. */
         void prepare (const juce::dsp::ProcessSpec& spec);
+        void release();
         void reset() noexcept;
-        void setBandGain (size_t index, float gainDb);
-        void setQFactor (float newQ) noexcept { qFactor = newQ; }
+        void setBandGain (size_t index, float gainDb) noexcept;
+        void setQFactor (float newQ) noexcept;
+        void setLinearPhase (bool shouldBeLinearPhase) noexcept;
+
+        /** Latency of the engine being heard: half the FIR length once the convolution is audible,
+            zero while the minimum-phase cascade is. Updated by process(). */
+        int getLatencySamples() const noexcept { return latencySamples.load(); }
+        int getMaximumLatencySamples() const noexcept { return firLength / 2; }
+
+        /** Designs and publishes coefficients if any gain changed since the last design.
+            Called by the design thread; must not be called from a real-time audio thread. */
+        void designPendingCoefficients();
+
         void process (juce::dsp::AudioBlock<float>& block) noexcept;
 
     private:
-        void updateBandCoefficients (size_t band);
+        void run() override;
+        void requestDesign() noexcept;
+        CoefficientSet designCoefficients() const noexcept;
+        CoefficientSet designOptimisedCoefficients();
+        void acceptDesign (const CoefficientSet& designed, bool cascadeAudible) noexcept;
+        void loadLinearPhaseFir (const CoefficientSet& set);
+        void startFade (int incomingEngine, int lengthSamples) noexcept;
+        void processEngine (juce::dsp::AudioBlock<float>& block, int engine) noexcept;
+        void primeConvolutions (const juce::dsp::AudioBlock<float>& block) noexcept;
+        bool isFirInstalled() const noexcept;
+        void resetConvolutions() noexcept;
 
         juce::dsp::ProcessSpec currentSpec{};
         bool isPrepared = false;
-        float qFactor = 1.0f;
-        std::array<float, 16> bandFrequencies{};
-        std::array<float, 16> bandGainsDb{};
-        std::array<std::array<juce::dsp::IIR::Filter<float>, 16>, 2> filters;
+        int rampLengthSamples = 1;
+        std::atomic<float> qFactor { 1.0f };
+        std::array<double, numBands> bandFrequencies{};
+        std::array<std::atomic<float>, numBands> bandGainsDb{};
+        std::atomic<bool> designRequested { false };
+        juce::CriticalSection designLock;
+        EQSectionOptimiser optimiser;
+
+        LatestValueMailbox<CoefficientSet> coefficientMailbox;
+        std::array<BiquadCascade, 2> cascades;
+        CoefficientSet cascadeDesign;       // Design loaded into the current cascade, audio thread only.
+        size_t currentCascade = 0;
+
+        // Linear-phase mode. The FFT, trig tables and firIsCurrent belong to the design thread.
+        int firLength = 0;
+        std::unique_ptr<juce::dsp::FFT> firFft;
+        std::vector<float> binCos1, binSin1, binCos2, binSin2;
+        std::vector<float> firWindow;
+        bool firIsCurrent = false;
+        std::atomic<bool> linearPhaseRequested { false };
+        std::atomic<int> latencySamples { 0 };
+        juce::dsp::ConvolutionMessageQueue convolutionQueue;                    // Must outlive the convolutions.
+        std::vector<std::unique_ptr<juce::dsp::Convolution>> convolutions;     // One per channel pair.
+        int primedSamples = 0;              // Input the convolutions have run on while silent, audio thread only.
+
+        // Engines 0 and 1 are the cascades. Engine switches are crossfaded, audio thread only.
+        static constexpr int convolutionEngine = 2;
+        int activeEngine = 0;
+        int fadingEngine = 0;
+        int fadeLength = 1;
+        int fadeRemaining = 0;
+        juce::AudioBuffer<float> fadeBuffer;
     };
 }
-
@@ -0,0 +1,216 @@
+#include "EQSectionOptimiser.h"
+#include "BiquadCoefficients.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+
+namespace reference_tone_matcher
+{
+    void EQSectionOptimiser::prepare (double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+
+        const auto numPoints = static_cast<size_t> (numGridPoints);
+        for (auto* table : { &cos1, &sin1, &cos2, &sin2, &targetDb, &sumDb, &candidateDb, &trialDb })
+            table->assign (numPoints, 0.0f);
+
+        for (auto& response : sectionResponsesDb)
+            response.assign (numPoints, 0.0f);
+
+        resetLayout();
+
+        const double lowest = 20.0;
+        const double highest = juce::jmin (20000.0, 0.45 * sampleRate);
+
+        for (size_t point = 0; point < numPoints; ++point)
+        {
+            const double frequency = lowest * std::pow (highest / lowest, static_cast<double> (point) / static_cast<double> (numPoints - 1));
+            const double omega = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+            cos1[point] = static_cast<float> (std::cos (omega));
+            sin1[point] = static_cast<float> (std::sin (omega));
+            cos2[point] = static_cast<float> (std::cos (2.0 * omega));
+            sin2[point] = static_cast<float> (std::sin (2.0 * omega));
+        }
+    }
+
+    int EQSectionOptimiser::optimise (SectionArray& sections, int numSections)
+    {
+        numSections = juce::jlimit (0, maxSections, numSections);
+        const auto numPoints = static_cast<size_t> (numGridPoints);
+
+        std::fill (targetDb.begin(), targetDb.end(), 0.0f);
+        for (size_t k = 0; k < static_cast<size_t> (numSections); ++k)
+        {
+            computeResponseDb (sections[k], sectionResponsesDb[k].data());
+            for (size_t point = 0; point < numPoints; ++point)
+                targetDb[point] += sectionResponsesDb[k][point];
+        }
+
+        sumDb = targetDb;
+
+        // Pruning, smallest gain first.
+        std::array<int, maxSections> order{};
+        for (int k = 0; k < numSections; ++k)
+            order[static_cast<size_t> (k)] = k;
+
+        std::sort (order.begin(), order.begin() + numSections, [&sections] (int a, int b)
+        {
+            return std::abs (sections[static_cast<size_t> (a)].gainDb) < std::abs (sections[static_cast<size_t> (b)].gainDb);
+        });
+
+        // A band that was kept last time is only pruned with hysteresisDb to spare.
+        juce::uint32 previouslyKept = 0;
+        for (size_t k = 0; k < static_cast<size_t> (juce::jmax (0, numPreviousSections)); ++k)
+            previouslyKept |= previousMasks[k];
+
+        std::array<bool, maxSections> removed{};
+        for (int i = 0; i < numSections; ++i)
+        {
+            const auto k = static_cast<size_t> (order[static_cast<size_t> (i)]);
+            if (std::abs (sections[k].gainDb) > pruneLimitDb)
+                break;
+
+            for (size_t point = 0; point < numPoints; ++point)
+                trialDb[point] = sumDb[point] - sectionResponsesDb[k][point];
+
+            const bool wasKept = numPreviousSections >= 0 && (sections[k].bandMask & previouslyKept) != 0;
+            if (getMaximumErrorDb (trialDb.data()) <= toleranceDb - (wasKept ? hysteresisDb : 0.0f))
+            {
+                std::swap (sumDb, trialDb);
+                removed[k] = true;
+            }
+        }
+
+        int numKept = 0;
+        for (size_t k = 0; k < static_cast<size_t> (numSections); ++k)
+        {
+            if (removed[k])
+                continue;
+
+            const auto target = static_cast<size_t> (numKept++);
+            if (target != k)
+            {
+                sections[target] = sections[k];
+                std::swap (sectionResponsesDb[target], sectionResponsesDb[k]);
+            }
+        }
+
+        // Merging of neighbours, repeated until no pair can be merged.
+        static constexpr std::array<double, 6> qScales { 0.85, 0.7, 0.6, 0.5, 0.42, 0.35 };
+
+        for (bool mergedAny = true; mergedAny;)
+        {
+            mergedAny = false;
+
+            for (size_t k = 0; k + 1 < static_cast<size_t> (numKept) && ! mergedAny; ++k)
+            {
+                const auto& lower = sections[k];
+                const auto& upper = sections[k + 1];
+                if ((lower.gainDb > 0.0f) != (upper.gainDb > 0.0f))
+                    continue;
+
+                Section merged;
+                merged.frequency = std::sqrt (lower.frequency * upper.frequency);
+                merged.bandMask = lower.bandMask | upper.bandMask;
+                const float mergeToleranceDb = toleranceDb - (wasInPreviousLayout (merged.bandMask) ? 0.0f : hysteresisDb);
+                const float centreGainDb = computeResponseDb (lower, merged.frequency) + computeResponseDb (upper, merged.frequency);
+
+                for (const auto qScale : qScales)
+                {
+                    merged.q = juce::jmin (lower.q, upper.q) * qScale;
+                    merged.gainDb = centreGainDb;
+                    computeResponseDb (merged, candidateDb.data());
+
+                    // The dB response of a peak is close to proportional to its gain, so one least-squares
+                    // step on the gain fits the pair's combined response well.
+                    double correlation = 0.0;
+                    double energy = 0.0;
+                    for (size_t point = 0; point < numPoints; ++point)
+                    {
+                        const double wanted = sectionResponsesDb[k][point] + sectionResponsesDb[k + 1][point];
+                        correlation += wanted * candidateDb[point];
+                        energy += static_cast<double> (candidateDb[point]) * candidateDb[point];
+                    }
+
+                    if (energy > 0.0)
+                    {
+                        merged.gainDb = static_cast<float> (centreGainDb * correlation / energy);
+                        computeResponseDb (merged, candidateDb.data());
+                    }
+
+                    for (size_t point = 0; point < numPoints; ++point)
+                        trialDb[point] = sumDb[point] - sectionResponsesDb[k][point] - sectionResponsesDb[k + 1][point] + candidateDb[point];
+
+                    if (getMaximumErrorDb (trialDb.data()) <= mergeToleranceDb)
+                    {
+                        mergedAny = true;
+                        break;
+                    }
+                }
+
+                if (mergedAny)
+                {
+                    std::swap (sumDb, trialDb);
+                    sections[k] = merged;
+                    std::swap (sectionResponsesDb[k], candidateDb);
+
+                    for (size_t j = k + 1; j + 1 < static_cast<size_t> (numKept); ++j)
+                    {
+                        sections[j] = sections[j + 1];
+                        std::swap (sectionResponsesDb[j], sectionResponsesDb[j + 1]);
+                    }
+
+                    --numKept;
+                }
+            }
+        }
+
+        for (size_t k = 0; k < static_cast<size_t> (numKept); ++k)
+            previousMasks[k] = sections[k].bandMask;
+
+        numPreviousSections = numKept;
+        return numKept;
+    }
+
+    bool EQSectionOptimiser::wasInPreviousLayout (juce::uint32 bandMask) const noexcept
+    {
+        // Before the first result there is no layout to hold on to. A mask inside a previous section
+        // counts too, so a section merged from three bands can be rebuilt one pair at a time.
+        if (numPreviousSections < 0)
+            return true;
+
+        for (size_t k = 0; k < static_cast<size_t> (numPreviousSections); ++k)
+            if ((previousMasks[k] & bandMask) == bandMask)
+                return true;
+
+        return false;
+    }
+
+    void EQSectionOptimiser::computeResponseDb (const Section& section, float* responseDb) const noexcept
+    {
+        const auto coefficients = BiquadCoefficients::makePeak (sampleRate, section.frequency, section.q, section.gainDb);
+
+        for (size_t point = 0; point < static_cast<size_t> (numGridPoints); ++point)
+            responseDb[point] = 10.0f * std::log10 (coefficients.getMagnitudeSquared (cos1[point], sin1[point], cos2[point], sin2[point]) + 1.0e-12f);
+    }
+
+    float EQSectionOptimiser::computeResponseDb (const Section& section, double frequency) const noexcept
+    {
+        const auto coefficients = BiquadCoefficients::makePeak (sampleRate, section.frequency, section.q, section.gainDb);
+        const double omega = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+
+        return 10.0f * std::log10 (coefficients.getMagnitudeSquared (static_cast<float> (std::cos (omega)), static_cast<float> (std::sin (omega)),
+                                                                     static_cast<float> (std::cos (2.0 * omega)), static_cast<float> (std::sin (2.0 * omega)))
+                                   + 1.0e-12f);
+    }
+
+    float EQSectionOptimiser::getMaximumErrorDb (const float* curveDb) const noexcept
+    {
+        float maximumError = 0.0f;
+        for (size_t point = 0; point < static_cast<size_t> (numGridPoints); ++point)
+            maximumError = juce::jmax (maximumError, std::abs (curveDb[point] - targetDb[point]));
+
+        return maximumError;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <juce_core/juce_core.h>
+
+namespace reference_tone_matcher
+{
+    /**
+        Reduces a bank of peaking bands to as few second-order sections as reproduce the same curve.
+
+        The response of every section is sampled in dB on a log-spaced grid. Sections are first
+        pruned, smallest gain first, as long as the summed response stays within the tolerance of the
+        original curve. Neighbouring sections with gains of the same sign are then merged greedily
+        into one wider section at their geometric centre, trying a few Qs with a least-squares gain
+        for each. The first candidate that stays within the tolerance is kept. Meant for the EQ
+        design thread; all memory is allocated in prepare.
+
+        The optimiser remembers the sections of its previous result. A band that was kept, or a pair
+        that was not merged, must fit hysteresisDb inside the tolerance before the layout changes,
+        so a gain hovering around the tolerance under automation does not flip the layout back and
+        forth.
+    */
+    class EQSectionOptimiser
+    {
+    public:
+        static constexpr int maxSections = 16;
+
+        struct Section
+        {
+            double frequency = 1000.0;
+            double q = 1.0;
+            float gainDb = 0.0f;
+            juce::uint32 bandMask = 0;      // Original bands represented by this section.
+        };
+
+        using SectionArray = std::array<Section, maxSections>;
+
+        EQSectionOptimiser() = default;
+
+        void prepare (double sampleRate);
+        void setToleranceDb (float newToleranceDb) noexcept { toleranceDb = newToleranceDb; }
+
+        /** Optimises the first numSections sections, which must be sorted by frequency, in place.
+            Returns the new number of sections, and remembers them for the next call. */
+        int optimise (SectionArray& sections, int numSections);
+
+        /** Forgets the previous result, so the next call decides without hysteresis. */
+        void resetLayout() noexcept { numPreviousSections = -1; }
+
+    private:
+        void computeResponseDb (const Section& section, float* responseDb) const noexcept;
+        float computeResponseDb (const Section& section, double frequency) const noexcept;
+        float getMaximumErrorDb (const float* curveDb) const noexcept;
+        bool wasInPreviousLayout (juce::uint32 bandMask) const noexcept;
+
+        static constexpr int numGridPoints = 96;
+        static constexpr float pruneLimitDb = 3.0f;     // Larger gains are never worth trying to prune.
+        static constexpr float hysteresisDb = 0.15f;    // Margin required to change the previous layout.
+
+        double sampleRate = 44100.0;
+        float toleranceDb = 0.5f;
+        std::vector<float> cos1, sin1, cos2, sin2;
+        std::vector<float> targetDb, sumDb, candidateDb, trialDb;
+        std::array<std::vector<float>, maxSections> sectionResponsesDb;
+        std::array<juce::uint32, maxSections> previousMasks{};
+        int numPreviousSections = -1;                   // -1 before the first result.
+    };
+}
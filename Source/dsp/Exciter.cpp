@@ -1,39 +1,68 @@
 #include "Exciter.h"
 
+#include <initializer_list>
+
 namespace reference_tone_matcher
 {
     void Exciter::prepare (const juce::dsp::ProcessSpec& spec)
     {
         currentSpec = spec;
-        oversampling = std::make_unique<juce::dsp::Oversampling<float>> (static_cast<size_t> (spec.numChannels),
-                                                                         2,
-                                                                         juce::dsp::Oversampling<float>::filterHalfBandFIREquiripple);
-        oversampling->initProcessing (static_cast<size_t> (spec.maximumBlockSize));
-
-        const auto oversampledRate = spec.sampleRate * static_cast<double> (1 << 2);
-        juce::dsp::ProcessSpec hpSpec { oversampledRate,
-                                        static_cast<juce::uint32> (static_cast<size_t> (spec.maximumBlockSize) * static_cast<size_t> (1 << 2)),
-                                        1 };
-        for (auto& filter : highpassFilters)
+
+        maximumLatency = 0;
+
+        for (size_t i = 0; i < oversamplers.size(); ++i)
         {
-            filter.prepare (hpSpec);
-            filter.coefficients = juce::dsp::IIR::Coefficients<float>::makeHighPass (oversampledRate, 6000.0, 0.707f);
+            oversamplers[i] = std::make_unique<juce::dsp::Oversampling<float>> (static_cast<size_t> (spec.numChannels),
+                                                                                i + 1,
+                                                                                juce::dsp::Oversampling<float>::filterHalfBandFIREquiripple);
+            lowLatencyOversamplers[i] = std::make_unique<juce::dsp::Oversampling<float>> (static_cast<size_t> (spec.numChannels),
+                                                                                          i + 1,
+                                                                                          juce::dsp::Oversampling<float>::filterHalfBandPolyphaseIIR);
+
+            for (auto* oversampler : { oversamplers[i].get(), lowLatencyOversamplers[i].get() })
+            {
+                oversampler->setUsingIntegerLatency (true);
+                oversampler->initProcessing (static_cast<size_t> (spec.maximumBlockSize));
+                maximumLatency = juce::jmax (maximumLatency, juce::roundToInt (oversampler->getLatencyInSamples()));
+            }
         }
 
-        reset();
+        // Changes requested before prepare need no fade.
+        oversamplingFactor = requestedFactor;
+        lowLatency = requestedLowLatency;
+
+        inputDelay.prepare (spec);
+        inputDelay.setMaximumDelayInSamples (maximumLatency);
+
+        const auto highpassCoefficients = BiquadCoefficients::makeHighPass (spec.sampleRate, highpassFrequency, 0.707);
+        highpass.prepare (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
+        highpass.setCoefficients (&highpassCoefficients, 1);
 
-        dryBuffer.setSize (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
-        dryBuffer.clear();
+        // Sized for the highest oversampling factor.
+        shaper.prepare (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize) * 4);
+
+        sideBuffer.setSize (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
+        sideBuffer.clear();
+
+        wetRampLength = juce::jmax (1, juce::roundToInt (spec.sampleRate * wetRampSeconds));
+        wetAmount = wetTarget;
+        rampTarget = wetTarget;
+        wetRampRemaining = 0;
+
+        isPrepared = true;
+        reset();
     }
 
     void Exciter::reset() noexcept
     {
-        if (oversampling != nullptr)
-            oversampling->reset();
-
-        for (auto& filter : highpassFilters)
-            filter.reset();
-
+        for (auto* bank : { &oversamplers, &lowLatencyOversamplers })
+            for (auto& oversampler : *bank)
+                if (oversampler != nullptr)
+                    oversampler->reset();
+
+        inputDelay.reset();
+        highpass.reset();
+        shaper.reset();
         driveLinear = 1.0f;
     }
 
@@ -45,38 +74,122 @@ namespace reference_tone_matcher
         const float driveDb = juce::jmap (crispAmount, 0.0f, 1.0f, -6.0f, 10.0f)
                             + juce::jmap (sparkleAmount, 0.0f, 1.0f, 0.0f, 8.0f);
         driveLinear = juce::Decibels::decibelsToGain (driveDb);
+
+        // Both amounts at zero is the off position; everywhere else the curve never reaches zero.
+        const bool isOff = crispAmount == 0.0f && sparkleAmount == 0.0f;
+        wetTarget = isOff ? 0.0f : juce::jlimit (0.0f, 1.0f, 0.2f + 0.8f * sparkleAmount * crispAmount);
+    }
+
+    bool Exciter::isSwapPending() const noexcept
+    {
+        return requestedFactor != oversamplingFactor || requestedLowLatency != lowLatency;
+    }
+
+    void Exciter::swapOversampler() noexcept
+    {
+        // The incoming oversampler starts from silence rather than from a stale filter history.
+        oversamplingFactor = requestedFactor;
+        lowLatency = requestedLowLatency;
+
+        if (auto* oversampler = getCurrentOversampler())
+            oversampler->reset();
+    }
+
+    int Exciter::getLatencySamples() const noexcept
+    {
+        if (auto* oversampler = getCurrentOversampler())
+            return juce::roundToInt (oversampler->getLatencyInSamples());
+
+        return 0;
+    }
+
+    juce::dsp::Oversampling<float>* Exciter::getCurrentOversampler() const noexcept
+    {
+        if (! isPrepared || oversamplingFactor == OversamplingFactor::one)
+            return nullptr;
+
+        const auto index = static_cast<size_t> (oversamplingFactor) - 1;
+        return lowLatency ? lowLatencyOversamplers[index].get() : oversamplers[index].get();
     }
 
     void Exciter::process (juce::dsp::AudioBlock<float>& block) noexcept
     {
-        if (oversampling == nullptr)
+        if (! isPrepared)
+            return;
+
+        const auto numChannels = juce::jmin (block.getNumChannels(), static_cast<size_t> (sideBuffer.getNumChannels()));
+        const auto numSamples = block.getNumSamples();
+        auto input = block.getSubsetChannelBlock (0, numChannels);
+
+        // A new oversampler is only swapped in once the side chain has faded out, and fades back in
+        // after the swap.
+        if (isSwapPending() && wetAmount == 0.0f)
+            swapOversampler();
+
+        const float target = isSwapPending() ? 0.0f : wetTarget;
+        if (target != rampTarget)
+        {
+            rampTarget = target;
+            wetRampRemaining = wetRampLength;
+        }
+
+        // Delay the input by the side chain's latency. The delay line always runs, so it holds valid
+        // history when the side chain wakes up, and crossfades when the latency changes.
+        inputDelay.setDelay (getLatencySamples());
+
+        if (wetAmount == 0.0f && rampTarget == 0.0f)
+        {
+            inputDelay.process (input);
+            sideChainIdle = true;
             return;
+        }
+
+        if (sideChainIdle)
+        {
+            highpass.reset();
+            shaper.reset();
+            if (auto* oversampler = getCurrentOversampler())
+                oversampler->reset();
 
-        const auto numChannels = static_cast<int> (block.getNumChannels());
-        const auto numSamples = static_cast<int> (block.getNumSamples());
+            sideChainIdle = false;
+        }
 
-        for (int ch = 0; ch < numChannels; ++ch)
-            dryBuffer.copyFrom (ch, 0, block.getChannelPointer (static_cast<size_t> (ch)), numSamples);
+        // Band-limit at the base rate, so only the part that gets shaped is oversampled.
+        juce::dsp::AudioBlock<float> side (sideBuffer.getArrayOfWritePointers(), numChannels, numSamples);
+        side.copyFrom (block);
+        highpass.process (side);
+        side.multiplyBy (driveLinear);
 
-        auto oversampledBlock = oversampling->processSamplesUp (block);
-        for (int ch = 0; ch < numChannels; ++ch)
+        if (auto* oversampler = getCurrentOversampler())
+        {
+            auto oversampledBlock = oversampler->processSamplesUp (side);
+            shaper.process (oversampledBlock);
+            oversampler->processSamplesDown (side);
+        }
+        else
         {
-            auto channelBlock = oversampledBlock.getSingleChannelBlock (static_cast<size_t> (ch));
-            highpassFilters[static_cast<size_t> (ch)].process (juce::dsp::ProcessContextReplacing<float> (channelBlock));
-            channelBlock.multiplyBy (driveLinear);
-            shaper.process (juce::dsp::ProcessContextReplacing<float> (channelBlock));
+            shaper.process (side);
         }
 
-        oversampling->processSamplesDown (block);
+        inputDelay.process (input);
+
+        const auto numRampSamples = static_cast<size_t> (juce::jmin (wetRampRemaining, static_cast<int> (numSamples)));
+        const float wetStep = wetRampRemaining > 0 ? (rampTarget - wetAmount) / static_cast<float> (wetRampRemaining) : 0.0f;
 
-        const float wetAmount = juce::jlimit (0.0f, 1.0f, 0.2f + 0.8f * sparkleAmount * crispAmount);
-        for (int ch = 0; ch < numChannels; ++ch)
+        for (size_t ch = 0; ch < numChannels; ++ch)
         {
-            float* dst = block.getChannelPointer (static_cast<size_t> (ch));
-            const float* dry = dryBuffer.getReadPointer (ch);
-            for (int i = 0; i < numSamples; ++i)
-                dst[i] = dry[i] + wetAmount * dst[i];
+            float* output = block.getChannelPointer (ch);
+            const float* shaped = side.getChannelPointer (ch);
+
+            for (size_t i = 0; i < numRampSamples; ++i)
+                output[i] += (wetAmount + wetStep * static_cast<float> (i + 1)) * shaped[i];
+
+            // Samples after the ramp only exist once it has finished.
+            juce::FloatVectorOperations::addWithMultiply (output + numRampSamples, shaped + numRampSamples, rampTarget,
+                                                          static_cast<int> (numSamples - numRampSamples));
         }
+
+        wetRampRemaining -= static_cast<int> (numRampSamples);
+        wetAmount = wetRampRemaining == 0 ? rampTarget : wetAmount + wetStep * static_cast<float> (numRampSamples);
     }
 }
-
@@ -4,30 +4,73 @@
 #include <memory>
 #include <juce_dsp/juce_dsp.h>
 
+#include "BiquadCascade.h"
+#include "CrossfadingDelay.h"
+#include "TanhShaper.h"
+
 namespace reference_tone_matcher
 {
     /**
         Adds high frequency sparkle by generating controlled harmonic content with oversampling.
+
+        Audio thread only. process() adds a shaped high band to the input, delayed by
+        getLatencySamples(); crisp = 0 with sparkle = 0 turns it off.
     */
     class Exciter
     {
     public:
+        enum class OversamplingFactor
+        {
+            one = 0,    // Shape at the base rate.
+            two = 1,
+            four = 2
+        };
+
         Exciter() = default;
 
         void prepare (const juce::dsp::ProcessSpec& spec);
         void reset() noexcept;
         void setAmounts (float crisp, float sparkle) noexcept;
+        void setOversamplingFactor (OversamplingFactor newFactor) noexcept { requestedFactor = newFactor; }
+        void setAntiAliasing (bool shouldUseAntiAliasing) noexcept { shaper.setAntiderivativeAntiAliasing (shouldUseAntiAliasing); }
+        void setLowLatency (bool shouldUseLowLatency) noexcept { requestedLowLatency = shouldUseLowLatency; }
+
+        /** Latency of the oversampling factor and filter type in use. Factor and low-latency changes
+            take effect once the side chain has faded out, about 10 ms after they are requested. */
+        int getLatencySamples() const noexcept;
+        int getMaximumLatencySamples() const noexcept { return maximumLatency; }
+
         void process (juce::dsp::AudioBlock<float>& block) noexcept;
 
     private:
+        static constexpr double highpassFrequency = 6000.0;
+        static constexpr double wetRampSeconds = 0.01;
+
+        juce::dsp::Oversampling<float>* getCurrentOversampler() const noexcept;
+        bool isSwapPending() const noexcept;
+        void swapOversampler() noexcept;
+
         float crispAmount = 0.5f;
         float sparkleAmount = 0.5f;
-        std::unique_ptr<juce::dsp::Oversampling<float>> oversampling;
-        std::array<juce::dsp::IIR::Filter<float>, 2> highpassFilters;
-        juce::dsp::WaveShaper<float> shaper { [] (float x) { return std::tanh (x); } };
+        float wetAmount = 0.0f;             // Level of the side chain that is added back.
+        float wetTarget = 0.4f;             // 0.2 + 0.8 * sparkle * crisp at the default amounts.
+        float rampTarget = 0.4f;            // wetTarget, or zero while an oversampler swap is pending.
+        int wetRampLength = 1;
+        int wetRampRemaining = 0;
+        bool sideChainIdle = false;
+        OversamplingFactor oversamplingFactor = OversamplingFactor::four;
+        OversamplingFactor requestedFactor = OversamplingFactor::four;
+        bool lowLatency = false;
+        bool requestedLowLatency = false;
+        std::array<std::unique_ptr<juce::dsp::Oversampling<float>>, 2> oversamplers;             // FIR, 2x and 4x.
+        std::array<std::unique_ptr<juce::dsp::Oversampling<float>>, 2> lowLatencyOversamplers;   // IIR, 2x and 4x.
+        CrossfadingDelay inputDelay;
+        int maximumLatency = 0;
+        BiquadCascade highpass;
+        TanhShaper shaper;
         float driveLinear = 1.0f;
-        juce::AudioBuffer<float> dryBuffer;
+        juce::AudioBuffer<float> sideBuffer;
         juce::dsp::ProcessSpec currentSpec{};
+        bool isPrepared = false;
     };
 }
-
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace reference_tone_matcher
+{
+    /**
+        Lock-free single-producer, single-consumer mailbox that always holds the latest value.
+
+        A triple buffer: the writer fills its private slot and swaps it with the shared middle slot,
+        the reader swaps the middle slot with its own when something new has arrived. Neither side
+        ever blocks or allocates, which makes it suitable for handing data to the audio thread.
+    */
+    template <typename ValueType>
+    class LatestValueMailbox
+    {
+    public:
+        /** Writer side. Replaces any value the reader has not fetched yet. */
+        void publish (const ValueType& value) noexcept
+        {
+            slots[static_cast<size_t> (writeIndex)] = value;
+            const int previous = middle.exchange (writeIndex | newValueFlag, std::memory_order_acq_rel);
+            writeIndex = previous & indexMask;
+        }
+
+        /** Reader side. Returns a pointer to the newest value, or nullptr if nothing new arrived.
+            The pointer stays valid until the next call to fetch. */
+        const ValueType* fetch() noexcept
+        {
+            if ((middle.load (std::memory_order_acquire) & newValueFlag) == 0)
+                return nullptr;
+
+            const int previous = middle.exchange (readIndex, std::memory_order_acq_rel);
+            readIndex = previous & indexMask;
+            return &slots[static_cast<size_t> (readIndex)];
+        }
+
+    private:
+        static constexpr int indexMask = 3;
+        static constexpr int newValueFlag = 4;
+
+        std::array<ValueType, 3> slots{};
+        std::atomic<int> middle { 1 };
+        int writeIndex = 0;
+        int readIndex = 2;
+    };
+}
@@ -0,0 +1,193 @@
+#include "LiveProfiler.h"
+#include "SpectrumAnalyser.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace reference_tone_matcher
+{
+    LiveProfiler::LiveProfiler (const juce::String& threadName)
+        : juce::Thread (threadName),
+          fft (SpectrumAnalyser::fftOrder),
+          publishedProfile (std::make_shared<const ReferenceProfile>())
+    {
+        fifoData.allocate (fifoSize, true);
+        windowTable.allocate (SpectrumAnalyser::fftSize, true);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables (windowTable.getData(), SpectrumAnalyser::fftSize,
+                                                                  juce::dsp::WindowingFunction<float>::hann);
+        frame.allocate (SpectrumAnalyser::fftSize, true);
+        fftScratch.allocate (2 * SpectrumAnalyser::fftSize, true);
+    }
+
+    LiveProfiler::~LiveProfiler()
+    {
+        release();
+    }
+
+    void LiveProfiler::prepare (double sampleRate)
+    {
+        release();
+
+        currentSampleRate = sampleRate;
+        bandMap = AnalysisBandMap (SpectrumAnalyser::fftSize, sampleRate);
+        attackCoeff = std::exp (-1.0f / (0.003f * static_cast<float> (sampleRate)));
+        releaseCoeff = std::exp (-1.0f / (0.05f * static_cast<float> (sampleRate)));
+
+        fifo.reset();
+        resetAverages();
+        hasPublishedLevels.store (false);
+        lastHopRmsDb.store (-100.0f);
+        numAnalysedHops.store (0);
+        startThread (juce::Thread::Priority::low);
+    }
+
+    void LiveProfiler::release()
+    {
+        stopThread (1000);
+    }
+
+    void LiveProfiler::pushSamples (const juce::AudioBuffer<float>& buffer, int firstChannel, int numChannels, int numSamples) noexcept
+    {
+        if (numChannels <= 0 || numSamples <= 0)
+            return;
+
+        const float channelGain = 1.0f / static_cast<float> (numChannels);
+        const int readyBefore = fifo.getNumReady();
+        const auto scope = fifo.write (juce::jmin (numSamples, fifo.getFreeSpace()));
+
+        // The FIFO hands out up to two contiguous regions; downmix straight into them.
+        auto downmix = [&] (int fifoStart, int count, int sourceOffset)
+        {
+            if (count <= 0)
+                return;
+
+            float* dest = fifoData.getData() + fifoStart;
+            juce::FloatVectorOperations::copyWithMultiply (dest, buffer.getReadPointer (firstChannel, sourceOffset), channelGain, count);
+            for (int ch = firstChannel + 1; ch < firstChannel + numChannels; ++ch)
+                juce::FloatVectorOperations::addWithMultiply (dest, buffer.getReadPointer (ch, sourceOffset), channelGain, count);
+        };
+
+        downmix (scope.startIndex1, scope.blockSize1, 0);
+        downmix (scope.startIndex2, scope.blockSize2, scope.blockSize1);
+
+        // Wake the background thread about once per hop rather than once per block.
+        const int readyAfter = readyBefore + scope.blockSize1 + scope.blockSize2;
+        if (readyBefore < SpectrumAnalyser::hopSize && readyAfter >= SpectrumAnalyser::hopSize)
+            notify();
+    }
+
+    ReferenceProfile LiveProfiler::getProfile() const
+    {
+        return *std::atomic_load (&publishedProfile);
+    }
+
+    bool LiveProfiler::getBandLevelsDb (std::array<float, 16>& levelsDb) const noexcept
+    {
+        if (! hasPublishedLevels.load (std::memory_order_acquire))
+            return false;
+
+        for (size_t band = 0; band < levelsDb.size(); ++band)
+            levelsDb[band] = publishedBandLevelsDb[band].load (std::memory_order_relaxed);
+
+        return true;
+    }
+
+    void LiveProfiler::run()
+    {
+        while (! threadShouldExit())
+        {
+            drainFifo();
+            wait (-1);
+        }
+    }
+
+    void LiveProfiler::drainFifo()
+    {
+        for (;;)
+        {
+            const int numReady = fifo.getNumReady();
+            if (numReady == 0 || threadShouldExit())
+                return;
+
+            const int numToRead = juce::jmin (numReady, SpectrumAnalyser::fftSize - numInFrame);
+            const auto scope = fifo.read (numToRead);
+
+            auto consume = [this] (int fifoStart, int count)
+            {
+                const float* source = fifoData.getData() + fifoStart;
+
+                for (int i = 0; i < count; ++i)
+                {
+                    const float sample = std::abs (source[i]);
+                    peakEnvelope = sample > peakEnvelope ? attackCoeff * peakEnvelope + (1.0f - attackCoeff) * sample
+                                                         : releaseCoeff * peakEnvelope + (1.0f - releaseCoeff) * sample;
+                    sustainEnvelope = 0.999f * sustainEnvelope + 0.001f * sample;
+                }
+
+                std::memcpy (frame.getData() + numInFrame, source, sizeof (float) * static_cast<size_t> (count));
+                numInFrame += count;
+            };
+
+            consume (scope.startIndex1, scope.blockSize1);
+            consume (scope.startIndex2, scope.blockSize2);
+
+            if (numInFrame == SpectrumAnalyser::fftSize)
+            {
+                analyseFrame();
+
+                // Keep the second half as the start of the next, overlapping frame.
+                std::memmove (frame.getData(), frame.getData() + SpectrumAnalyser::hopSize, sizeof (float) * SpectrumAnalyser::hopSize);
+                numInFrame = SpectrumAnalyser::hopSize;
+            }
+        }
+    }
+
+    void LiveProfiler::analyseFrame()
+    {
+        constexpr int fftSize = SpectrumAnalyser::fftSize;
+        constexpr int hopSize = SpectrumAnalyser::hopSize;
+
+        const double hopSquare = static_cast<double> (sumOfSquares (frame.getData() + fftSize - hopSize, hopSize)) / hopSize;
+
+        float* scratch = fftScratch.getData();
+        juce::FloatVectorOperations::multiply (scratch, frame.getData(), windowTable.getData(), fftSize);
+        fft.performRealOnlyForwardTransform (scratch, true);
+        accumulateBandPowers (bandMap, scratch, hopBandPowers.data());
+
+        const float hopTransient = juce::jlimit (0.0f, 1.0f, peakEnvelope / (sustainEnvelope + 1.0e-6f));
+
+        // Update the running averages in place instead of re-analysing a history window.
+        const double hopSeconds = hopSize / currentSampleRate;
+        const double smoothing = hasAverages ? std::exp (-hopSeconds / static_cast<double> (timeConstantSeconds.load())) : 0.0;
+
+        for (size_t band = 0; band < averageBandPowers.size(); ++band)
+            averageBandPowers[band] = smoothing * averageBandPowers[band] + (1.0 - smoothing) * static_cast<double> (hopBandPowers[band]);
+
+        averageSquare = smoothing * averageSquare + (1.0 - smoothing) * hopSquare;
+        averageTransient = static_cast<float> (smoothing * averageTransient + (1.0 - smoothing) * hopTransient);
+        hasAverages = true;
+
+        auto profile = SpectrumAnalyser::makeProfile (averageBandPowers, averageTransient, static_cast<float> (std::sqrt (averageSquare)));
+        profile.sourceName = getThreadName();
+        profile.isValid = true;
+
+        for (size_t band = 0; band < publishedBandLevelsDb.size(); ++band)
+            publishedBandLevelsDb[band].store (profile.eqGainsDb[band], std::memory_order_relaxed);
+
+        lastHopRmsDb.store (juce::Decibels::gainToDecibels (static_cast<float> (std::sqrt (hopSquare))), std::memory_order_relaxed);
+        hasPublishedLevels.store (true, std::memory_order_release);
+        numAnalysedHops.fetch_add (1, std::memory_order_release);
+        std::atomic_store (&publishedProfile, std::make_shared<const ReferenceProfile> (std::move (profile)));
+    }
+
+    void LiveProfiler::resetAverages() noexcept
+    {
+        numInFrame = 0;
+        averageBandPowers.fill (0.0);
+        averageSquare = 0.0;
+        averageTransient = 0.0f;
+        peakEnvelope = 0.0f;
+        sustainEnvelope = 0.0f;
+        hasAverages = false;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_dsp/juce_dsp.h>
+
+#include "AnalysisBandMap.h"
+#include "ReferenceProfile.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Continuously profiles a live signal with the same band layout as SpectrumAnalyser.
+
+        The audio thread only downmixes each block into a preallocated single-producer,
+        single-consumer FIFO; it never locks or allocates. A background thread drains the FIFO,
+        runs the STFT hop by hop and keeps exponentially weighted band powers, RMS and transient
+        estimates, from which it publishes a fresh ReferenceProfile after every hop.
+    */
+    class LiveProfiler : private juce::Thread
+    {
+    public:
+        explicit LiveProfiler (const juce::String& threadName = "Live profiler");
+        ~LiveProfiler() override;
+
+        /** Allocates the FIFO and analysis buffers and starts the background thread. */
+        void prepare (double sampleRate);
+
+        /** Stops the background thread and forgets the running averages. */
+        void release();
+
+        /** Sets the time constant of the exponential averaging in seconds. */
+        void setTimeConstant (float seconds) noexcept { timeConstantSeconds.store (juce::jmax (0.05f, seconds)); }
+
+        /** Real-time safe. Samples that do not fit into the FIFO are dropped. */
+        void pushSamples (const juce::AudioBuffer<float>& buffer, int firstChannel, int numChannels, int numSamples) noexcept;
+
+        /** Returns the most recent profile; invalid until the first hop has been analysed. */
+        ReferenceProfile getProfile() const;
+
+        /** Real-time safe access to the band levels of the most recent profile.
+            Returns false until the first hop has been analysed. */
+        bool getBandLevelsDb (std::array<float, 16>& levelsDb) const noexcept;
+
+        /** Real-time safe. Counts the hops analysed since prepare, so a caller can tell when
+            the published levels have stopped updating. */
+        juce::uint32 getNumAnalysedHops() const noexcept { return numAnalysedHops.load (std::memory_order_acquire); }
+
+        /** Real-time safe. RMS of the most recent hop alone, without the running average. */
+        float getLastHopRmsDb() const noexcept { return lastHopRmsDb.load (std::memory_order_relaxed); }
+
+        /** Real-time safe. Makes getBandLevelsDb return false until the next hop is analysed,
+            for when the signal feeding the profiler has gone away. */
+        void clearPublishedLevels() noexcept { hasPublishedLevels.store (false, std::memory_order_release); }
+
+        static constexpr int fifoSize = 1 << 16;
+
+    private:
+        void run() override;
+        void drainFifo();
+        void analyseFrame();
+        void resetAverages() noexcept;
+
+        juce::AbstractFifo fifo { fifoSize };
+        juce::HeapBlock<float> fifoData;
+        double currentSampleRate = 44100.0;
+        std::atomic<float> timeConstantSeconds { 3.0f };
+
+        // Owned by the background thread.
+        juce::dsp::FFT fft;
+        AnalysisBandMap bandMap;
+        juce::HeapBlock<float> windowTable;
+        juce::HeapBlock<float> frame;
+        juce::HeapBlock<float> fftScratch;
+        int numInFrame = 0;
+        std::array<double, 16> averageBandPowers{};
+        std::array<float, 16> hopBandPowers{};
+        double averageSquare = 0.0;
+        float averageTransient = 0.0f;
+        float peakEnvelope = 0.0f;
+        float sustainEnvelope = 0.0f;
+        float attackCoeff = 0.0f;
+        float releaseCoeff = 0.0f;
+        bool hasAverages = false;
+
+        std::shared_ptr<const ReferenceProfile> publishedProfile;
+        std::array<std::atomic<float>, 16> publishedBandLevelsDb{};
+        std::atomic<bool> hasPublishedLevels { false };
+        std::atomic<float> lastHopRmsDb { -100.0f };
+        std::atomic<juce::uint32> numAnalysedHops { 0 };
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LiveProfiler)
+    };
+}
@@ -1,85 +1,408 @@
 #include "MultiBandDynamics.h"
 
+#include "AnalysisBandMap.h"
+
+#include <cmath>
+
 namespace reference_tone_matcher
 {
+    namespace
+    {
+        constexpr double minCrossoverHz = 60.0;
+        constexpr double maxCrossoverHz = 12000.0;
+        constexpr double minCrossoverRatio = 1.5;      // Closest allowed spacing of neighbouring crossovers.
+    }
+
     void MultiBandDynamics::prepare (const juce::dsp::ProcessSpec& spec)
     {
-        currentSpec = spec;
-        lowMidCrossover.reset();
-        midHighCrossover.reset();
+        sampleRate = spec.sampleRate;
+        numChannels = static_cast<int> (spec.numChannels);
+        maximumBlockSize = juce::jmax (1, static_cast<int> (spec.maximumBlockSize));
+        crossoverRampSamples = juce::jmax (1, juce::roundToInt (sampleRate * crossoverRampSeconds));
+
+        for (size_t k = 0; k < bandBuffers.size(); ++k)
+        {
+            lowPasses[k].prepare (numChannels, maximumBlockSize);
+            highPasses[k].prepare (numChannels, maximumBlockSize);
+            allPasses[k].prepare (numChannels, maximumBlockSize);
+            bandBuffers[k].setSize (numChannels, maximumBlockSize);
+        }
 
-        lowMidCrossover.setCutoffFrequency (200.0f);
-        midHighCrossover.setCutoffFrequency (4000.0f);
+        compressors.prepare (sampleRate, numChannels, maximumBlockSize, getMaximumLatencySamples());
 
-        lowMidCrossover.prepare (spec);
-        midHighCrossover.prepare (spec);
+        bypassDelay.prepare ({ sampleRate, static_cast<juce::uint32> (maximumBlockSize), static_cast<juce::uint32> (numChannels) });
+        bypassDelay.setMaximumDelayInSamples (getMaximumLatencySamples());
+        bypassBuffer.setSize (numChannels, maximumBlockSize);
+        fadeLength = juce::jmax (1, juce::roundToInt (sampleRate * bypassFadeSeconds));
+        fadeGain = active ? 1.0f : 0.0f;
+        fadeRemaining = 0;
+        updateBandParameters();
 
-        lowBandComp.prepare (spec);
-        midBandComp.prepare (spec);
-        highBandComp.prepare (spec);
+        configuredBands = 0;
+        updateCrossovers();
 
         reset();
     }
 
     void MultiBandDynamics::reset() noexcept
     {
-        lowMidCrossover.reset();
-        midHighCrossover.reset();
-        lowBandComp.reset();
-        midBandComp.reset();
-        highBandComp.reset();
+        for (size_t k = 0; k < bandBuffers.size(); ++k)
+        {
+            lowPasses[k].reset();
+            highPasses[k].reset();
+            allPasses[k].reset();
+        }
+
+        compressors.reset();
+        bypassDelay.reset();
     }
 
     void MultiBandDynamics::setAmount (float glueAmount) noexcept
     {
-        glue = juce::jlimit (0.0f, 1.0f, glueAmount);
+        const float newGlue = juce::jlimit (0.0f, 1.0f, glueAmount);
+
+        if (newGlue != glue)
+        {
+            glue = newGlue;
+            updateBandParameters();
+        }
 
-        const float thresholdLow = juce::jmap (glue, 0.0f, 1.0f, -6.0f, -20.0f);
-        const float thresholdMid = juce::jmap (glue, 0.0f, 1.0f, -8.0f, -18.0f);
-        const float thresholdHigh = juce::jmap (glue, 0.0f, 1.0f, -10.0f, -16.0f);
-        const float ratio = juce::jmap (glue, 0.0f, 1.0f, 1.2f, 3.5f);
+        // Once no band compresses, the stage fades out and then only aligns the signal.
+        const bool shouldBeActive = ! bandsNeutral;
+        if (shouldBeActive != active)
+        {
+            active = shouldBeActive;
+            fadeRemaining = fadeLength;
+        }
+    }
 
-        lowBandComp.setThreshold (thresholdLow);
-        lowBandComp.setRatio (ratio);
-        lowBandComp.setAttack (juce::jmap (glue, 0.0f, 1.0f, 25.0f, 5.0f));
-        lowBandComp.setRelease (juce::jmap (glue, 0.0f, 1.0f, 120.0f, 80.0f));
+    void MultiBandDynamics::setLookahead (float lookaheadMs) noexcept
+    {
+        const double clampedMs = juce::jlimit (0.0, maximumLookaheadMs, static_cast<double> (lookaheadMs));
+        compressors.setLookahead (juce::roundToInt (clampedMs * 0.001 * sampleRate));
+    }
+
+    int MultiBandDynamics::getMaximumLatencySamples() const noexcept
+    {
+        return static_cast<int> (std::ceil (maximumLookaheadMs * 0.001 * sampleRate));
+    }
 
-        midBandComp.setThreshold (thresholdMid);
-        midBandComp.setRatio (ratio + 0.2f);
-        midBandComp.setAttack (juce::jmap (glue, 0.0f, 1.0f, 15.0f, 4.0f));
-        midBandComp.setRelease (juce::jmap (glue, 0.0f, 1.0f, 100.0f, 70.0f));
+    void MultiBandDynamics::setNumBands (int newNumBands) noexcept
+    {
+        newNumBands = juce::jlimit (minBands, maxBands, newNumBands);
 
-        highBandComp.setThreshold (thresholdHigh);
-        highBandComp.setRatio (ratio + 0.5f);
-        highBandComp.setAttack (juce::jmap (glue, 0.0f, 1.0f, 10.0f, 2.0f));
-        highBandComp.setRelease (juce::jmap (glue, 0.0f, 1.0f, 80.0f, 50.0f));
-        highBandComp.setMakeUpGainDecibels (juce::jmap (glue, 0.0f, 1.0f, 0.0f, 2.5f));
+        if (newNumBands != numBands)
+        {
+            numBands = newNumBands;
+            crossoversChanged = true;
+            updateBandParameters();
+        }
+    }
+
+    void MultiBandDynamics::setUseProfileCrossovers (bool shouldUseProfile) noexcept
+    {
+        if (shouldUseProfile != useProfileCrossovers)
+        {
+            useProfileCrossovers = shouldUseProfile;
+            crossoversChanged = true;
+        }
+    }
+
+    void MultiBandDynamics::setReferenceProfile (const ReferenceProfile& profile) noexcept
+    {
+        CrossoverLayouts layouts{};
+        for (int bands = minBands; bands <= maxBands; ++bands)
+            layouts[static_cast<size_t> (bands)] = deriveCrossovers (profile, bands);
+
+        profileCrossoverMailbox.publish (layouts);
     }
 
     void MultiBandDynamics::process (juce::dsp::AudioBlock<float>& block) noexcept
     {
-        if (block.getNumSamples() == 0)
+        processBands (block, nullptr, 1.0f);
+    }
+
+    void MultiBandDynamics::process (juce::dsp::AudioBlock<float>& block, const juce::dsp::AudioBlock<const float>& dry, float wetAmount) noexcept
+    {
+        processBands (block, &dry, wetAmount);
+    }
+
+    void MultiBandDynamics::processBands (juce::dsp::AudioBlock<float>& block, const juce::dsp::AudioBlock<const float>* dry, float wetAmount) noexcept
+    {
+        if (const auto* layouts = profileCrossoverMailbox.fetch())
+        {
+            profileCrossovers = *layouts;
+            hasProfileCrossovers = true;
+            crossoversChanged = crossoversChanged || useProfileCrossovers;
+        }
+
+        if (crossoversChanged)
+            updateCrossovers();
+
+        const auto channels = juce::jmin (static_cast<size_t> (numChannels), block.getNumChannels());
+        const auto topBand = static_cast<size_t> (numBands - 1);
+
+        if (channels == 0)
             return;
 
-        auto lowBand = lowMidCrossover.processLowpass (block);
-        auto remainder = lowMidCrossover.processHighpass (block);
-        auto midBand = midHighCrossover.processLowpass (remainder);
-        auto highBand = midHighCrossover.processHighpass (remainder);
+        const float dryAmount = 1.0f - wetAmount;
+
+        for (size_t start = 0; start < block.getNumSamples(); start += static_cast<size_t> (maximumBlockSize))
+        {
+            const auto numSamples = juce::jmin (static_cast<size_t> (maximumBlockSize), block.getNumSamples() - start);
+            auto remainder = block.getSubBlock (start, numSamples).getSubsetChannelBlock (0, channels);
+            const bool fullyBypassed = ! active && fadeRemaining == 0;
+            const int lookahead = compressors.getLookaheadSamples();
+
+            // The bypass path carries the input with the same latency as the bands. With lookahead its
+            // delay runs all the time, so it has valid history whenever a fade starts.
+            auto bypassed = juce::dsp::AudioBlock<float> (bypassBuffer.getArrayOfWritePointers(), channels, numSamples);
+            const bool needsBypassSignal = fullyBypassed || fadeRemaining > 0 || lookahead > 0;
+            if (needsBypassSignal)
+            {
+                bypassed.copyFrom (remainder);
+                bypassDelay.setDelay (static_cast<float> (lookahead));
+                bypassDelay.process (juce::dsp::ProcessContextReplacing<float> (bypassed));
+            }
+
+            if (fullyBypassed)
+            {
+                bandsIdle = true;
+
+                for (size_t ch = 0; ch < channels; ++ch)
+                {
+                    float* output = remainder.getChannelPointer (ch);
+                    const float* input = bypassed.getChannelPointer (ch);
+
+                    if (dry == nullptr)
+                        juce::FloatVectorOperations::copy (output, input, static_cast<int> (numSamples));
+                    else
+                        for (size_t i = 0; i < numSamples; ++i)
+                            output[i] = dry->getChannelPointer (ch)[start + i] * dryAmount + input[i] * wetAmount;
+                }
+
+                continue;
+            }
+
+            // Coming back from bypass: start from silence, the fade-in covers the settling. The fade
+            // is held at zero until the lookahead history has filled again.
+            if (bandsIdle)
+            {
+                fadeGain = -static_cast<float> (lookahead) / static_cast<float> (fadeLength);
+                fadeRemaining = fadeLength + lookahead;
+
+                for (size_t k = 0; k < bandBuffers.size(); ++k)
+                {
+                    lowPasses[k].reset();
+                    highPasses[k].reset();
+                    allPasses[k].reset();
+                }
+
+                compressors.reset();
+                bandsIdle = false;
+            }
 
-        lowBandComp.process (juce::dsp::ProcessContextReplacing<float> (lowBand));
-        midBandComp.process (juce::dsp::ProcessContextReplacing<float> (midBand));
-        highBandComp.process (juce::dsp::ProcessContextReplacing<float> (highBand));
+            std::array<juce::dsp::AudioBlock<float>, maxBands> bands;
 
-        for (size_t ch = 0; ch < block.getNumChannels(); ++ch)
+            // Each crossover takes its low band off the remainder, which is left as the top band.
+            for (size_t k = 0; k < topBand; ++k)
+            {
+                bands[k] = juce::dsp::AudioBlock<float> (bandBuffers[k].getArrayOfWritePointers(), channels, numSamples);
+                bands[k].copyFrom (remainder);
+                lowPasses[k].process (bands[k]);
+                highPasses[k].process (remainder);
+            }
+
+            bands[topBand] = remainder;
+            compressors.process (bands.data(), numBands);
+
+            // Sum bottom-up, passing the lower bands through the all-pass of every crossover they skipped.
+            auto& sum = bands[0];
+            for (size_t k = 1; k < topBand; ++k)
+            {
+                allPasses[k].process (sum);
+                sum.add (bands[k]);
+            }
+
+            const auto numFadeSamples = static_cast<size_t> (juce::jmin (fadeRemaining, static_cast<int> (numSamples)));
+            const float fadeTarget = active ? 1.0f : 0.0f;
+            const float fadeStep = fadeRemaining > 0 ? (fadeTarget - fadeGain) / static_cast<float> (fadeRemaining) : 0.0f;
+
+            if (dry == nullptr && numFadeSamples == 0)
+            {
+                remainder.add (sum);
+                continue;
+            }
+
+            // Final summation, crossfaded against the bypass path while fading and mixed with the dry
+            // signal if one is given, so the output is written once.
+            for (size_t ch = 0; ch < channels; ++ch)
+            {
+                float* output = remainder.getChannelPointer (ch);
+                const float* lower = sum.getChannelPointer (ch);
+                const float* input = bypassed.getChannelPointer (ch);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                {
+                    float processed = output[i] + lower[i];
+
+                    if (numFadeSamples > 0)
+                    {
+                        const float gain = i < numFadeSamples ? juce::jmax (0.0f, fadeGain + fadeStep * static_cast<float> (i + 1)) : fadeTarget;
+                        processed = input[i] + gain * (processed - input[i]);
+                    }
+
+                    output[i] = dry == nullptr ? processed
+                                               : dry->getChannelPointer (ch)[start + i] * dryAmount + processed * wetAmount;
+                }
+            }
+
+            fadeRemaining -= static_cast<int> (numFadeSamples);
+            fadeGain = fadeRemaining == 0 ? fadeTarget : fadeGain + fadeStep * static_cast<float> (numFadeSamples);
+        }
+    }
+
+    MultiBandDynamics::CrossoverArray MultiBandDynamics::getDefaultCrossovers (int bands) noexcept
+    {
+        bands = juce::jlimit (minBands, maxBands, bands);
+        CrossoverArray frequencies{};
+
+        if (bands == 2)
         {
-            auto* dest = block.getChannelPointer (ch);
-            const auto* low = lowBand.getChannelPointer (ch);
-            const auto* mid = midBand.getChannelPointer (ch);
-            const auto* high = highBand.getChannelPointer (ch);
+            frequencies[0] = static_cast<float> (std::sqrt (200.0 * 4000.0));
+            return frequencies;
+        }
+
+        for (int k = 0; k < bands - 1; ++k)
+            frequencies[static_cast<size_t> (k)] = static_cast<float> (200.0 * std::pow (20.0, static_cast<double> (k) / static_cast<double> (bands - 2)));
+
+        return frequencies;
+    }
+
+    MultiBandDynamics::CrossoverArray MultiBandDynamics::deriveCrossovers (const ReferenceProfile& profile, int bands) noexcept
+    {
+        bands = juce::jlimit (minBands, maxBands, bands);
+
+        if (! profile.isValid)
+            return getDefaultCrossovers (bands);
 
-            for (size_t i = 0; i < block.getNumSamples(); ++i)
-                dest[i] = low[i] + mid[i] + high[i];
+        // The profile holds the mean power per bin of each analysis band, so the energy of a band
+        // also scales with its width.
+        const auto edges = AnalysisBandMap::getBandEdgesHz();
+        std::array<double, AnalysisBandMap::numBands> energies{};
+        double totalEnergy = 0.0;
+
+        for (size_t band = 0; band < energies.size(); ++band)
+        {
+            energies[band] = std::pow (10.0, static_cast<double> (profile.eqGainsDb[band]) / 10.0) * (edges[band + 1] - edges[band]);
+            totalEnergy += energies[band];
         }
+
+        if (! (totalEnergy > 0.0))
+            return getDefaultCrossovers (bands);
+
+        // Place each crossover where the cumulative energy reaches its share, interpolating
+        // logarithmically inside the analysis band.
+        CrossoverArray frequencies{};
+        double cumulative = 0.0;
+        size_t band = 0;
+
+        for (int k = 1; k < bands; ++k)
+        {
+            const double target = totalEnergy * static_cast<double> (k) / static_cast<double> (bands);
+
+            while (band < energies.size() - 1 && cumulative + energies[band] < target)
+                cumulative += energies[band++];
+
+            const double fraction = juce::jlimit (0.0, 1.0, (target - cumulative) / juce::jmax (1.0e-30, energies[band]));
+            frequencies[static_cast<size_t> (k - 1)] = static_cast<float> (edges[band] * std::pow (edges[band + 1] / edges[band], fraction));
+        }
+
+        // Keep the crossovers in range and spaced apart, first pushing up and then pulling back down.
+        const auto numCrossovers = static_cast<size_t> (bands - 1);
+        for (size_t k = 0; k < numCrossovers; ++k)
+        {
+            const double lowest = k == 0 ? minCrossoverHz : frequencies[k - 1] * minCrossoverRatio;
+            frequencies[k] = static_cast<float> (juce::jlimit (minCrossoverHz, maxCrossoverHz, juce::jmax (lowest, static_cast<double> (frequencies[k]))));
+        }
+
+        for (size_t k = numCrossovers - 1; k-- > 0;)
+            frequencies[k] = static_cast<float> (juce::jmin (static_cast<double> (frequencies[k]), frequencies[k + 1] / minCrossoverRatio));
+
+        return frequencies;
     }
-}
 
+    void MultiBandDynamics::updateCrossovers() noexcept
+    {
+        const auto frequencies = useProfileCrossovers && hasProfileCrossovers ? profileCrossovers[static_cast<size_t> (numBands)]
+                                                                              : getDefaultCrossovers (numBands);
+        const double q = juce::MathConstants<double>::sqrt2 * 0.5;
+
+        for (int k = 0; k < numBands - 1; ++k)
+        {
+            const auto index = static_cast<size_t> (k);
+            const double frequency = juce::jlimit (20.0, 0.45 * sampleRate, static_cast<double> (frequencies[index]));
+
+            // Fourth-order Linkwitz-Riley: two identical Butterworth sections per side.
+            const auto lowPass = BiquadCoefficients::makeLowPass (sampleRate, frequency, q);
+            const auto highPass = BiquadCoefficients::makeHighPass (sampleRate, frequency, q);
+            const auto allPass = BiquadCoefficients::makeAllPass (sampleRate, frequency, q);
+            const std::array<BiquadCoefficients, 2> lowSections { lowPass, lowPass };
+            const std::array<BiquadCoefficients, 2> highSections { highPass, highPass };
+
+            if (k < configuredBands - 1)
+            {
+                lowPasses[index].rampToCoefficients (lowSections.data(), crossoverRampSamples);
+                highPasses[index].rampToCoefficients (highSections.data(), crossoverRampSamples);
+                allPasses[index].rampToCoefficients (&allPass, crossoverRampSamples);
+            }
+            else
+            {
+                lowPasses[index].setCoefficients (lowSections.data(), 2);
+                highPasses[index].setCoefficients (highSections.data(), 2);
+                allPasses[index].setCoefficients (&allPass, 1);
+                lowPasses[index].reset();
+                highPasses[index].reset();
+                allPasses[index].reset();
+            }
+        }
+
+        configuredBands = numBands;
+        crossoversChanged = false;
+    }
+
+    void MultiBandDynamics::updateBandParameters() noexcept
+    {
+        // The lowest and highest band keep the settings of the former low and high compressor;
+        // bands in between are interpolated by position.
+        const float lowThreshold = juce::jmap (glue, 0.0f, 1.0f, -6.0f, -20.0f);
+        const float highThreshold = juce::jmap (glue, 0.0f, 1.0f, -10.0f, -16.0f);
+        const float lowAttack = juce::jmap (glue, 0.0f, 1.0f, 25.0f, 5.0f);
+        const float highAttack = juce::jmap (glue, 0.0f, 1.0f, 10.0f, 2.0f);
+        const float lowRelease = juce::jmap (glue, 0.0f, 1.0f, 120.0f, 80.0f);
+        const float highRelease = juce::jmap (glue, 0.0f, 1.0f, 80.0f, 50.0f);
+        const float makeUp = juce::jmap (glue, 0.0f, 1.0f, 0.0f, 2.5f);
+
+        // glue = 0 is the off position: every band runs at ratio 1, so the stage can be bypassed.
+        const float ratio = glue > 0.0f ? juce::jmap (glue, 0.0f, 1.0f, 1.2f, 3.5f) : 1.0f;
+        const float ratioSpread = glue > 0.0f ? 0.5f : 0.0f;
+
+        bool neutral = makeUp == 0.0f;
+
+        for (int band = 0; band < numBands; ++band)
+        {
+            const float position = static_cast<float> (band) / static_cast<float> (numBands - 1);
+            const float bandRatio = ratio + ratioSpread * position;
+            neutral = neutral && bandRatio <= 1.0f + 1.0e-3f;
+
+            compressors.setBandParameters (band,
+                                           juce::jmap (position, lowThreshold, highThreshold),
+                                           bandRatio,
+                                           juce::jmap (position, lowAttack, highAttack),
+                                           juce::jmap (position, lowRelease, highRelease),
+                                           band == numBands - 1 ? makeUp : 0.0f);
+        }
+
+        bandsNeutral = neutral;
+    }
+}
@@ -1,30 +1,99 @@
 #pragma once
 
+#include <array>
 #include <juce_dsp/juce_dsp.h>
 
+#include "BiquadCascade.h"
+#include "CompressorBank.h"
+#include "LatestValueMailbox.h"
+#include "ReferenceProfile.h"
+
 namespace reference_tone_matcher
 {
     /**
-        Three band dynamics processor that glues the spectrum together with musical compression.
+        Multiband dynamics processor that glues the spectrum together with musical compression.
+
+        Audio thread only, except setReferenceProfile. process() splits 2 to 6 Linkwitz-Riley bands,
+        compresses them and delays the result by the lookahead; at glue = 0 it only delays.
     */
     class MultiBandDynamics
     {
     public:
+        static constexpr int minBands = 2;
+        static constexpr int maxBands = CompressorBank::maxBands;
+        static constexpr int defaultNumBands = 3;
+        static constexpr double maximumLookaheadMs = 5.0;
+
+        using CrossoverArray = std::array<float, maxBands - 1>;
+
         MultiBandDynamics() = default;
 
         void prepare (const juce::dsp::ProcessSpec& spec);
         void reset() noexcept;
         void setAmount (float glueAmount) noexcept;
+
+        /** Audio thread. Clamped to maximumLookaheadMs. */
+        void setLookahead (float lookaheadMs) noexcept;
+        int getLatencySamples() const noexcept { return compressors.getLookaheadSamples(); }
+        int getMaximumLatencySamples() const noexcept;
+
+        /** Audio thread. Crossovers that are added start from a cleared state. */
+        void setNumBands (int newNumBands) noexcept;
+        int getNumBands() const noexcept { return numBands; }
+
+        /** Audio thread. Falls back to the default crossovers until a profile has been set. */
+        void setUseProfileCrossovers (bool shouldUseProfile) noexcept;
+
+        /** Derives crossovers for every band count from the profile. Must only be called from one
+            thread other than the audio thread, typically the message thread. */
+        void setReferenceProfile (const ReferenceProfile& profile) noexcept;
+
         void process (juce::dsp::AudioBlock<float>& block) noexcept;
 
+        /** Like process, but mixes the result with the dry signal while summing the bands, so the
+            output is written only once: block = dry * (1 - wetAmount) + dynamics * wetAmount. */
+        void process (juce::dsp::AudioBlock<float>& block, const juce::dsp::AudioBlock<const float>& dry, float wetAmount) noexcept;
+
+        static CrossoverArray getDefaultCrossovers (int numBands) noexcept;
+        static CrossoverArray deriveCrossovers (const ReferenceProfile& profile, int numBands) noexcept;
+
     private:
-        juce::dsp::ProcessSpec currentSpec{};
-        juce::dsp::LinkwitzRileyFilter<float> lowMidCrossover;
-        juce::dsp::LinkwitzRileyFilter<float> midHighCrossover;
-        juce::dsp::Compressor<float> lowBandComp;
-        juce::dsp::Compressor<float> midBandComp;
-        juce::dsp::Compressor<float> highBandComp;
+        /** Crossovers for each band count, indexed by the band count. */
+        using CrossoverLayouts = std::array<CrossoverArray, maxBands + 1>;
+
+        void processBands (juce::dsp::AudioBlock<float>& block, const juce::dsp::AudioBlock<const float>* dry, float wetAmount) noexcept;
+        void updateCrossovers() noexcept;
+        void updateBandParameters() noexcept;
+
+        static constexpr double crossoverRampSeconds = 0.02;
+        static constexpr double bypassFadeSeconds = 0.01;
+
+        double sampleRate = 44100.0;
+        int numChannels = 0;
+        int maximumBlockSize = 0;
+        int crossoverRampSamples = 1;
+
         float glue = 0.5f;
+        int numBands = defaultNumBands;
+        int configuredBands = 0;            // Band count the crossover filters are currently set up for.
+        bool useProfileCrossovers = false;
+        bool hasProfileCrossovers = false;
+        bool crossoversChanged = true;
+
+        bool bandsNeutral = false;          // Every band at ratio 1 without make-up gain.
+        bool active = true;                 // Target state; some band compresses.
+        bool bandsIdle = false;             // The band filters were skipped and hold stale state.
+        float fadeGain = 1.0f;              // 1 for the processed signal, 0 for the bypass path.
+        int fadeLength = 1;
+        int fadeRemaining = 0;
+        juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> bypassDelay;
+        juce::AudioBuffer<float> bypassBuffer;
+
+        CrossoverLayouts profileCrossovers{};
+        LatestValueMailbox<CrossoverLayouts> profileCrossoverMailbox;
+
+        std::array<BiquadCascade, maxBands - 1> lowPasses, highPasses, allPasses;
+        std::array<juce::AudioBuffer<float>, maxBands - 1> bandBuffers;
+        CompressorBank compressors;
     };
 }
-
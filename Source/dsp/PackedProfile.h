@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+
+#include "ReferenceProfile.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Fixed-size, trivially copyable form of a ReferenceProfile for binary files.
+        The source name is not stored; readers restore it from the file they describe.
+    */
+    struct PackedProfile
+    {
+        float eqGainsDb[16];
+        float rmsLevelDb;
+        float spectralSlope;
+        float transientIntensity;
+        float sparkle;
+        float bite;
+        float glue;
+        float crispAmount;
+        juce::uint32 isValid;
+
+        static PackedProfile fromProfile (const ReferenceProfile& profile) noexcept
+        {
+            PackedProfile packed{};
+            std::copy (profile.eqGainsDb.begin(), profile.eqGainsDb.end(), packed.eqGainsDb);
+            packed.rmsLevelDb = profile.rmsLevelDb;
+            packed.spectralSlope = profile.spectralSlope;
+            packed.transientIntensity = profile.transientIntensity;
+            packed.sparkle = profile.sparkle;
+            packed.bite = profile.bite;
+            packed.glue = profile.glue;
+            packed.crispAmount = profile.crispAmount;
+            packed.isValid = profile.isValid ? 1u : 0u;
+            return packed;
+        }
+
+        ReferenceProfile toProfile (const juce::String& sourceName) const
+        {
+            ReferenceProfile profile;
+            std::copy (eqGainsDb, eqGainsDb + 16, profile.eqGainsDb.begin());
+            profile.rmsLevelDb = rmsLevelDb;
+            profile.spectralSlope = spectralSlope;
+            profile.transientIntensity = transientIntensity;
+            profile.sparkle = sparkle;
+            profile.bite = bite;
+            profile.glue = glue;
+            profile.crispAmount = crispAmount;
+            profile.sourceName = sourceName;
+            profile.isValid = isValid != 0;
+            return profile;
+        }
+    };
+
+    static_assert (std::is_trivially_copyable<PackedProfile>::value, "PackedProfile is written to disk as raw bytes");
+}
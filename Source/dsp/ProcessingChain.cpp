@@ -0,0 +1,120 @@
+#include "ProcessingChain.h"
+
+namespace reference_tone_matcher
+{
+    void ProcessingChain::Settings::applyProfile (const ReferenceProfile& profile) noexcept
+    {
+        // Clamped to the ranges of the matching plug-in parameters.
+        for (size_t band = 0; band < bandGainsDb.size(); ++band)
+            bandGainsDb[band] = juce::jlimit (-12.0f, 12.0f, profile.eqGainsDb[band]);
+
+        sparkle = juce::jlimit (0.0f, 1.0f, profile.sparkle);
+        bite = juce::jlimit (0.0f, 1.0f, profile.bite);
+        glue = juce::jlimit (0.0f, 1.0f, profile.glue);
+        crisp = juce::jlimit (0.0f, 1.0f, profile.crispAmount);
+    }
+
+    void ProcessingChain::prepare (double sampleRate, int maximumBlockSize, int numChannels)
+    {
+        tileLength = juce::jlimit (1, tileSize, maximumBlockSize);
+        const juce::dsp::ProcessSpec spec { sampleRate, static_cast<juce::uint32> (tileLength), static_cast<juce::uint32> (numChannels) };
+
+        // Set first, so the EQ designs its first curve for the right mode.
+        applySettings();
+
+        eqDesigner.prepare (spec);
+        transientDesigner.prepare (spec);
+        exciter.prepare (spec);
+        dynamics.prepare (spec);
+
+        dryBuffer.setSize (numChannels, tileLength, false, false, true);
+        dryBuffer.clear();
+        applySettings();
+
+        dryDelay.prepare (spec);
+        dryDelay.setMaximumDelayInSamples (getMaximumLatencySamples());
+    }
+
+    void ProcessingChain::reset() noexcept
+    {
+        eqDesigner.reset();
+        transientDesigner.reset();
+        exciter.reset();
+        dynamics.reset();
+        dryDelay.reset();
+    }
+
+    void ProcessingChain::release()
+    {
+        eqDesigner.release();
+    }
+
+    void ProcessingChain::setSettings (const Settings& newSettings) noexcept
+    {
+        settings = newSettings;
+        applySettings();
+    }
+
+    void ProcessingChain::applySettings() noexcept
+    {
+        // Low-latency mode overrides the linear-phase EQ, whose FIR alone costs tens of milliseconds.
+        eqDesigner.setLinearPhase (settings.linearPhase && ! settings.lowLatency);
+
+        // The designer ignores unchanged gains, so pushing every band each block is cheap.
+        for (size_t band = 0; band < settings.bandGainsDb.size(); ++band)
+            eqDesigner.setBandGain (band, settings.bandGainsDb[band]);
+
+        transientDesigner.setAmount (settings.bite);
+        transientDesigner.setStereoLink (settings.transientLink);
+
+        exciter.setAmounts (settings.crisp, settings.sparkle);
+        exciter.setOversamplingFactor (settings.exciterQuality);
+        exciter.setAntiAliasing (settings.exciterAntiAliasing);
+        exciter.setLowLatency (settings.lowLatency);
+
+        dynamics.setAmount (settings.glue);
+        dynamics.setNumBands (settings.dynamicsBands);
+        dynamics.setUseProfileCrossovers (settings.profileCrossovers);
+        dynamics.setLookahead (settings.lowLatency ? 0.0f : settings.dynamicsLookaheadMs);
+    }
+
+    int ProcessingChain::getLatencySamples() const noexcept
+    {
+        // The transient designer adds no latency; the dynamics only add their lookahead.
+        return eqDesigner.getLatencySamples() + exciter.getLatencySamples() + dynamics.getLatencySamples();
+    }
+
+    int ProcessingChain::getMaximumLatencySamples() const noexcept
+    {
+        return eqDesigner.getMaximumLatencySamples() + exciter.getMaximumLatencySamples() + dynamics.getMaximumLatencySamples();
+    }
+
+    void ProcessingChain::process (juce::dsp::AudioBlock<float>& block) noexcept
+    {
+        const auto numChannels = juce::jmin (block.getNumChannels(), static_cast<size_t> (dryBuffer.getNumChannels()));
+        const auto numSamples = block.getNumSamples();
+        auto channels = block.getSubsetChannelBlock (0, numChannels);
+        auto dryTiles = juce::dsp::AudioBlock<float> (dryBuffer).getSubsetChannelBlock (0, numChannels);
+
+        // The dry signal is copied and aligned per tile, and the wet/dry mix happens in the dynamics'
+        // final band summation.
+        for (size_t start = 0; start < numSamples; start += static_cast<size_t> (tileLength))
+        {
+            const auto tileSamples = juce::jmin (static_cast<size_t> (tileLength), numSamples - start);
+            auto tile = channels.getSubBlock (start, tileSamples);
+            auto dryTile = dryTiles.getSubBlock (0, tileSamples);
+
+            dryTile.copyFrom (tile);
+            eqDesigner.process (tile);
+
+            // The EQ decides per tile whether its linear-phase FIR is heard, so the delay is set after
+            // it. The delay line always runs and crossfades when the latency changes.
+            dryDelay.setDelay (getLatencySamples());
+            dryDelay.process (dryTile);
+
+            transientDesigner.process (tile);
+            exciter.process (tile);
+            dynamics.process (tile, dryTile, settings.wet);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_dsp/juce_dsp.h>
+
+#include "CrossfadingDelay.h"
+#include "ReferenceProfile.h"
+#include "EQDesigner.h"
+#include "TransientDesigner.h"
+#include "Exciter.h"
+#include "MultiBandDynamics.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        The complete signal path of the plug-in: EQ, transient designer, exciter and multiband
+        dynamics, mixed against a latency-aligned copy of the input.
+
+        Audio is pushed through all stages one tile at a time, so each tile is still in cache for the
+        next stage, and every module is prepared for a single tile. The plug-in feeds it from its
+        parameters; the offline tools drive it directly from Settings.
+    */
+    class ProcessingChain
+    {
+    public:
+        /** Everything the chain is controlled by, with the defaults of the plug-in parameters. */
+        struct Settings
+        {
+            std::array<float, 16> bandGainsDb{};
+            bool linearPhase = false;
+            bool lowLatency = false;
+            float wet = 1.0f;
+            float crisp = 0.5f;
+            float sparkle = 0.5f;
+            Exciter::OversamplingFactor exciterQuality = Exciter::OversamplingFactor::four;
+            bool exciterAntiAliasing = true;
+            float bite = 0.5f;
+            bool transientLink = false;
+            float glue = 0.5f;
+            int dynamicsBands = MultiBandDynamics::defaultNumBands;
+            bool profileCrossovers = false;
+            float dynamicsLookaheadMs = 0.0f;
+
+            /** Takes over the suggestions of a profile, as loading a reference does in the plug-in. */
+            void applyProfile (const ReferenceProfile& profile) noexcept;
+        };
+
+        static constexpr int tileSize = 256;     // Samples pushed through the whole chain at a time.
+
+        ProcessingChain() = default;
+
+        /** Blocks passed to process() may be of any length; they are split into tiles. */
+        void prepare (double sampleRate, int maximumBlockSize, int numChannels);
+        void reset() noexcept;
+
+        /** Stops the background EQ design thread. */
+        void release();
+
+        /** Real-time safe; unchanged values cost nothing. */
+        void setSettings (const Settings& newSettings) noexcept;
+        const Settings& getSettings() const noexcept { return settings; }
+
+        /** Hands the profile to the modules that derive more than the settings from it. */
+        void setReferenceProfile (const ReferenceProfile& profile) noexcept { dynamics.setReferenceProfile (profile); }
+
+        /** Designs pending EQ changes on the calling thread, for renders that outrun the design thread. */
+        void designPendingCoefficients() { eqDesigner.designPendingCoefficients(); }
+
+        /** Latency of the wet path, which the dry path is delayed by. */
+        int getLatencySamples() const noexcept;
+        int getMaximumLatencySamples() const noexcept;
+
+        void process (juce::dsp::AudioBlock<float>& block) noexcept;
+
+        EQDesigner& getEQDesigner() noexcept { return eqDesigner; }
+        TransientDesigner& getTransientDesigner() noexcept { return transientDesigner; }
+        Exciter& getExciter() noexcept { return exciter; }
+        MultiBandDynamics& getDynamics() noexcept { return dynamics; }
+
+    private:
+        void applySettings() noexcept;
+
+        Settings settings;
+        int tileLength = tileSize;
+
+        EQDesigner eqDesigner;
+        TransientDesigner transientDesigner;
+        Exciter exciter;
+        MultiBandDynamics dynamics;
+
+        juce::AudioBuffer<float> dryBuffer;     // One tile of the delayed input.
+        CrossfadingDelay dryDelay;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ProcessingChain)
+    };
+}
@@ -0,0 +1,224 @@
+#include "ProfileCache.h"
+#include "PackedProfile.h"
+
+#include <cstring>
+
+namespace reference_tone_matcher
+{
+    namespace
+    {
+        constexpr char cacheMagic[4] = { 'R', 'T', 'P', 'C' };
+        constexpr juce::uint32 cacheVersion = 1;
+        constexpr int sampledBlockSize = 64 * 1024;
+
+        struct CacheHeader
+        {
+            char magic[4];
+            juce::uint32 version;
+            juce::uint32 recordSize;
+            juce::uint32 reserved;
+        };
+
+        struct CacheRecord
+        {
+            ProfileCache::Key key;
+            PackedProfile profile;
+        };
+
+        static_assert (std::is_trivially_copyable<CacheRecord>::value, "CacheRecord is written to disk as raw bytes");
+
+        juce::uint64 fnv1a (const void* data, size_t numBytes, juce::uint64 hash) noexcept
+        {
+            const auto* bytes = static_cast<const juce::uint8*> (data);
+            for (size_t i = 0; i < numBytes; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+
+            return hash;
+        }
+
+        bool isValidHeader (const void* data, size_t size) noexcept
+        {
+            if (size < sizeof (CacheHeader))
+                return false;
+
+            CacheHeader header;
+            std::memcpy (&header, data, sizeof (header));
+            return std::memcmp (header.magic, cacheMagic, sizeof (cacheMagic)) == 0
+                && header.version == cacheVersion
+                && header.recordSize == sizeof (CacheRecord);
+        }
+    }
+
+    ProfileCache::ProfileCache (const juce::File& cacheFileToUse)
+        : cacheFile (cacheFileToUse)
+    {
+    }
+
+    ProfileCache::~ProfileCache() = default;
+
+    juce::File ProfileCache::getDefaultCacheFile()
+    {
+        return juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory)
+                   .getChildFile ("ReferenceToneMatcher")
+                   .getChildFile ("ProfileCache.bin");
+    }
+
+    ProfileCache::Key ProfileCache::makeKey (const juce::File& audioFile, juce::uint64 settingsHash)
+    {
+        Key key;
+        key.fileSize = static_cast<juce::uint64> (audioFile.getSize());
+        key.modificationTime = audioFile.getLastModificationTime().toMilliseconds();
+        key.settingsHash = settingsHash;
+
+        // Hash the head, middle and tail of the file rather than all of it, so building a key
+        // stays cheap for large files on slow drives.
+        juce::uint64 hash = fnv1a (&key.fileSize, sizeof (key.fileSize), 14695981039346656037ull);
+        juce::FileInputStream stream (audioFile);
+
+        if (stream.openedOk())
+        {
+            juce::HeapBlock<char> block (sampledBlockSize);
+            const auto totalSize = static_cast<juce::int64> (key.fileSize);
+            const juce::int64 offsets[] = { 0,
+                                            juce::jmax<juce::int64> (0, totalSize / 2 - sampledBlockSize / 2),
+                                            juce::jmax<juce::int64> (0, totalSize - sampledBlockSize) };
+
+            for (const auto offset : offsets)
+            {
+                if (! stream.setPosition (offset))
+                    break;
+
+                const int numRead = stream.read (block.getData(), sampledBlockSize);
+                hash = fnv1a (block.getData(), static_cast<size_t> (juce::jmax (0, numRead)), hash);
+            }
+        }
+
+        key.contentHash = hash;
+        return key;
+    }
+
+    bool ProfileCache::lookup (const Key& key, ReferenceProfile& profile) const
+    {
+        const juce::ScopedLock sl (lock);
+
+        // Another instance may truncate the file in store, and touching a mapped page past the end
+        // of the file faults, so the mapping is only read while that cannot happen.
+        const juce::InterProcessLock::ScopedLockType processLock (fileLock);
+
+        if (! processLock.isLocked())
+            return false;
+
+        if (cacheFile.getSize() != mappedSize)
+            remap();
+
+        if (mappedFile == nullptr || ! isValidHeader (mappedFile->getData(), mappedFile->getSize()))
+            return false;
+
+        const auto* data = static_cast<const char*> (mappedFile->getData());
+        const auto numRecords = (mappedFile->getSize() - sizeof (CacheHeader)) / sizeof (CacheRecord);
+
+        // Newer records are appended, so search backwards to find the most recent one first.
+        for (auto i = numRecords; i > 0; --i)
+        {
+            CacheRecord record;
+            std::memcpy (&record, data + sizeof (CacheHeader) + (i - 1) * sizeof (CacheRecord), sizeof (record));
+
+            if (record.key == key)
+            {
+                profile = record.profile.toProfile (profile.sourceName);
+                return profile.isValid;
+            }
+        }
+
+        return false;
+    }
+
+    bool ProfileCache::store (const Key& key, const ReferenceProfile& profile)
+    {
+        if (! profile.isValid)
+            return false;
+
+        const juce::ScopedLock sl (lock);
+        const juce::InterProcessLock::ScopedLockType processLock (fileLock);
+
+        if (! processLock.isLocked())
+            return false;
+
+        if (! cacheFile.getParentDirectory().createDirectory())
+            return false;
+
+        // Start over if the header is missing, torn or written by an incompatible version.
+        bool hasValidHeader = false;
+        if (cacheFile.existsAsFile())
+        {
+            CacheHeader header{};
+            juce::FileInputStream input (cacheFile);
+            hasValidHeader = input.openedOk()
+                          && input.read (&header, sizeof (header)) == static_cast<int> (sizeof (header))
+                          && isValidHeader (&header, sizeof (header));
+        }
+
+        // Our own view of the file must not outlive a truncation.
+        mappedFile.reset();
+        mappedSize = -1;
+
+        juce::FileOutputStream output (cacheFile);
+        if (! output.openedOk())
+            return false;
+
+        if (hasValidHeader)
+        {
+            // Drop a record torn by a crash mid-append, so later records stay aligned.
+            const auto numRecords = (static_cast<size_t> (output.getPosition()) - sizeof (CacheHeader)) / sizeof (CacheRecord);
+            const auto alignedSize = static_cast<juce::int64> (sizeof (CacheHeader) + numRecords * sizeof (CacheRecord));
+
+            if (output.getPosition() != alignedSize
+                && (! output.setPosition (alignedSize) || output.truncate().failed()))
+                return false;
+        }
+        else
+        {
+            if (! output.setPosition (0) || output.truncate().failed())
+                return false;
+
+            CacheHeader header{};
+            std::memcpy (header.magic, cacheMagic, sizeof (cacheMagic));
+            header.version = cacheVersion;
+            header.recordSize = sizeof (CacheRecord);
+
+            if (! output.write (&header, sizeof (header)))
+                return false;
+        }
+
+        const CacheRecord record { key, PackedProfile::fromProfile (profile) };
+        const bool written = output.write (&record, sizeof (record));
+        output.flush();
+
+        return written;
+    }
+
+    int ProfileCache::getNumRecords() const
+    {
+        const juce::ScopedLock sl (lock);
+        const auto size = cacheFile.getSize();
+        return size > static_cast<juce::int64> (sizeof (CacheHeader))
+                 ? static_cast<int> ((static_cast<size_t> (size) - sizeof (CacheHeader)) / sizeof (CacheRecord))
+                 : 0;
+    }
+
+    void ProfileCache::remap() const
+    {
+        mappedFile.reset();
+        mappedSize = cacheFile.getSize();
+
+        if (mappedSize > 0)
+        {
+            mappedFile = std::make_unique<juce::MemoryMappedFile> (cacheFile, juce::MemoryMappedFile::readOnly);
+            if (mappedFile->getData() == nullptr)
+                mappedFile.reset();
+        }
+    }
+}
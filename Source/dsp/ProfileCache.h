@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <juce_core/juce_core.h>
+
+#include "ReferenceProfile.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Persistent cache of analysed reference profiles.
+
+        Profiles are stored as fixed-size binary records in a single file that is memory-mapped for
+        lookup, so a repeated load of a known reference costs a key comparison per record instead of
+        a decode and analysis. Records are keyed by the file identity (size, modification time and a
+        sampled content hash) together with a hash of the analysis settings. New records are appended
+        under an inter-process lock, which lets several plug-in instances share one cache file.
+        A file with a torn or foreign header is recreated, and a torn trailing record is trimmed
+        before the next append.
+        The file uses native byte order and is meant to stay on the machine that wrote it.
+    */
+    class ProfileCache
+    {
+    public:
+        struct Key
+        {
+            juce::uint64 fileSize = 0;
+            juce::int64 modificationTime = 0;    // Milliseconds since the epoch.
+            juce::uint64 contentHash = 0;
+            juce::uint64 settingsHash = 0;
+
+            bool operator== (const Key& other) const noexcept
+            {
+                return fileSize == other.fileSize && modificationTime == other.modificationTime
+                    && contentHash == other.contentHash && settingsHash == other.settingsHash;
+            }
+        };
+
+        explicit ProfileCache (const juce::File& cacheFileToUse);
+        ~ProfileCache();
+
+        /** Builds the key for a file. Reads a few sampled blocks of the file for the content hash. */
+        static Key makeKey (const juce::File& audioFile, juce::uint64 settingsHash);
+
+        /** Returns true and fills the profile when a record with this key exists. */
+        bool lookup (const Key& key, ReferenceProfile& profile) const;
+
+        /** Appends a record for a valid profile. */
+        bool store (const Key& key, const ReferenceProfile& profile);
+
+        int getNumRecords() const;
+        const juce::File& getCacheFile() const noexcept { return cacheFile; }
+
+        static juce::File getDefaultCacheFile();
+
+    private:
+        void remap() const;
+
+        juce::File cacheFile;
+        juce::CriticalSection lock;
+        mutable juce::InterProcessLock fileLock { "ReferenceToneMatcherProfileCache" };
+        mutable std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+        mutable juce::int64 mappedSize = -1;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ProfileCache)
+    };
+}
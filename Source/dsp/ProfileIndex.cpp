@@ -0,0 +1,97 @@
+#include "ProfileIndex.h"
+#include "PackedProfile.h"
+
+#include <cstring>
+
+namespace reference_tone_matcher
+{
+    namespace
+    {
+        constexpr char indexMagic[4] = { 'R', 'T', 'P', 'I' };
+        constexpr juce::uint32 indexVersion = 1;
+    }
+
+    bool ProfileIndex::load (const juce::File& file)
+    {
+        entries.clear();
+        settingsHash = 0;
+
+        juce::FileInputStream input (file);
+        if (! input.openedOk())
+            return false;
+
+        char magic[4] = {};
+        if (input.read (magic, sizeof (magic)) != static_cast<int> (sizeof (magic))
+            || std::memcmp (magic, indexMagic, sizeof (magic)) != 0
+            || static_cast<juce::uint32> (input.readInt()) != indexVersion
+            || static_cast<size_t> (input.readInt()) != sizeof (PackedProfile))
+            return false;
+
+        settingsHash = static_cast<juce::uint64> (input.readInt64());
+        const auto numEntries = input.readInt();
+        if (numEntries < 0)
+            return false;
+
+        entries.reserve (static_cast<size_t> (numEntries));
+
+        for (int i = 0; i < numEntries; ++i)
+        {
+            Entry entry;
+            entry.path = input.readString();
+            entry.fileSize = static_cast<juce::uint64> (input.readInt64());
+            entry.modificationTime = input.readInt64();
+
+            PackedProfile packed;
+            if (input.read (&packed, sizeof (packed)) != static_cast<int> (sizeof (packed)))
+            {
+                entries.clear();
+                return false;
+            }
+
+            entry.profile = packed.toProfile (juce::File (entry.path).getFileName());
+            entries.push_back (std::move (entry));
+        }
+
+        return true;
+    }
+
+    bool ProfileIndex::save (const juce::File& file) const
+    {
+        juce::TemporaryFile temporary (file);
+
+        {
+            juce::FileOutputStream output (temporary.getFile());
+            if (! output.openedOk())
+                return false;
+
+            output.write (indexMagic, sizeof (indexMagic));
+            output.writeInt (static_cast<int> (indexVersion));
+            output.writeInt (static_cast<int> (sizeof (PackedProfile)));
+            output.writeInt64 (static_cast<juce::int64> (settingsHash));
+            output.writeInt (static_cast<int> (entries.size()));
+
+            for (const auto& entry : entries)
+            {
+                output.writeString (entry.path);
+                output.writeInt64 (static_cast<juce::int64> (entry.fileSize));
+                output.writeInt64 (entry.modificationTime);
+
+                const auto packed = PackedProfile::fromProfile (entry.profile);
+                output.write (&packed, sizeof (packed));
+            }
+
+            output.flush();
+            if (output.getStatus().failed())
+                return false;
+        }
+
+        return temporary.overwriteTargetFileWithTemporary();
+    }
+
+    bool ProfileIndex::isUpToDate (const Entry& entry, const juce::File& file)
+    {
+        return entry.profile.isValid
+            && entry.fileSize == static_cast<juce::uint64> (file.getSize())
+            && entry.modificationTime == file.getLastModificationTime().toMilliseconds();
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <juce_core/juce_core.h>
+
+#include "ReferenceProfile.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Compact binary index of the profiles of a reference library.
+        Every entry remembers the file's path, size and modification time, so an indexer can tell
+        which files changed since the index was written.
+    */
+    class ProfileIndex
+    {
+    public:
+        struct Entry
+        {
+            juce::String path;
+            juce::uint64 fileSize = 0;
+            juce::int64 modificationTime = 0;
+            ReferenceProfile profile;
+        };
+
+        ProfileIndex() = default;
+
+        /** Replaces the contents with the index stored in file. Returns false if it is missing or invalid. */
+        bool load (const juce::File& file);
+
+        /** Writes the index through a temporary file, so readers never see a partial index. */
+        bool save (const juce::File& file) const;
+
+        void setSettingsHash (juce::uint64 newHash) noexcept { settingsHash = newHash; }
+        juce::uint64 getSettingsHash() const noexcept { return settingsHash; }
+
+        std::vector<Entry>& getEntries() noexcept { return entries; }
+        const std::vector<Entry>& getEntries() const noexcept { return entries; }
+
+        /** True if the entry still describes the file on disk. */
+        static bool isUpToDate (const Entry& entry, const juce::File& file);
+
+    private:
+        juce::uint64 settingsHash = 0;
+        std::vector<Entry> entries;
+    };
+}
@@ -0,0 +1,98 @@
+#include "ProfileSearchIndex.h"
+
+#include <algorithm>
+
+namespace reference_tone_matcher
+{
+    ProfileSearchIndex::ProfileSearchIndex (ProfileIndex sourceIndex)
+        : index (std::move (sourceIndex))
+    {
+        const auto& entries = index.getEntries();
+        numProfiles = entries.size();
+
+        const size_t numRegisters = (numProfiles + Vec::SIMDNumElements - 1) / Vec::SIMDNumElements;
+        for (auto& column : columns)
+            column.assign (numRegisters, Vec::expand (0.0f));
+
+        for (size_t i = 0; i < numProfiles; ++i)
+        {
+            const auto features = getFeatures (entries[i].profile);
+            for (size_t feature = 0; feature < features.size(); ++feature)
+                columns[feature][i / Vec::SIMDNumElements].set (i % Vec::SIMDNumElements, features[feature]);
+        }
+    }
+
+    std::vector<ProfileSearchIndex::Match> ProfileSearchIndex::findNearest (const ReferenceProfile& query,
+                                                                           int k,
+                                                                           const Weights& weights) const
+    {
+        std::vector<Match> matches;
+        if (numProfiles == 0 || k <= 0)
+            return matches;
+
+        const auto queryFeatures = getFeatures (query);
+        const auto featureWeights = getFeatureWeights (weights);
+        const size_t numRegisters = columns[0].size();
+
+        // Accumulate the weighted squared distance feature by feature, so every pass streams
+        // through one contiguous column.
+        std::vector<Vec> distances (numRegisters, Vec::expand (0.0f));
+        for (size_t feature = 0; feature < columns.size(); ++feature)
+        {
+            const auto target = Vec::expand (queryFeatures[feature]);
+            const auto weight = Vec::expand (featureWeights[feature]);
+            const auto* column = columns[feature].data();
+
+            for (size_t r = 0; r < numRegisters; ++r)
+            {
+                const auto difference = column[r] - target;
+                distances[r] += weight * difference * difference;
+            }
+        }
+
+        // Keep the k smallest distances in a max-heap.
+        const auto numMatches = static_cast<size_t> (juce::jmin (k, static_cast<int> (numProfiles)));
+        const auto isCloser = [] (const Match& a, const Match& b) { return a.distance < b.distance; };
+        matches.reserve (numMatches);
+
+        for (size_t i = 0; i < numProfiles; ++i)
+        {
+            const float distance = distances[i / Vec::SIMDNumElements].get (i % Vec::SIMDNumElements);
+
+            if (matches.size() < numMatches)
+            {
+                matches.push_back ({ i, distance });
+                std::push_heap (matches.begin(), matches.end(), isCloser);
+            }
+            else if (distance < matches.front().distance)
+            {
+                std::pop_heap (matches.begin(), matches.end(), isCloser);
+                matches.back() = { i, distance };
+                std::push_heap (matches.begin(), matches.end(), isCloser);
+            }
+        }
+
+        std::sort_heap (matches.begin(), matches.end(), isCloser);
+        return matches;
+    }
+
+    std::array<float, ProfileSearchIndex::numFeatures> ProfileSearchIndex::getFeatures (const ReferenceProfile& profile) noexcept
+    {
+        std::array<float, numFeatures> features{};
+        std::copy (profile.eqGainsDb.begin(), profile.eqGainsDb.end(), features.begin());
+        features[16] = profile.spectralSlope;
+        features[17] = profile.transientIntensity;
+        features[18] = profile.rmsLevelDb;
+        return features;
+    }
+
+    std::array<float, ProfileSearchIndex::numFeatures> ProfileSearchIndex::getFeatureWeights (const Weights& weights) noexcept
+    {
+        std::array<float, numFeatures> featureWeights{};
+        std::fill (featureWeights.begin(), featureWeights.begin() + 16, weights.band);
+        featureWeights[16] = weights.slope;
+        featureWeights[17] = weights.transient;
+        featureWeights[18] = weights.loudness;
+        return featureWeights;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <juce_dsp/juce_dsp.h>
+
+#include "ProfileIndex.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        In-memory nearest-neighbour index over the profiles of a ProfileIndex.
+
+        The 16 band gains plus spectral slope, transient intensity and loudness are stored
+        structure-of-arrays, one column per feature with SIMD-register granularity, so a query is a
+        single vectorised sweep per feature followed by a top-k selection. Queries are const and can
+        run concurrently; none of this is meant for the audio thread.
+    */
+    class ProfileSearchIndex
+    {
+    public:
+        static constexpr int numFeatures = 16 + 3;
+
+        /** Squared feature differences are scaled by these weights before summing. */
+        struct Weights
+        {
+            float band = 1.0f;          // Per band, differences in dB.
+            float slope = 16.0f;        // Spectral slope in dB per band.
+            float transient = 100.0f;   // Normalised transient intensity.
+            float loudness = 0.1f;      // RMS level in dB.
+        };
+
+        struct Match
+        {
+            size_t index = 0;           // Entry in getEntries().
+            float distance = 0.0f;
+        };
+
+        ProfileSearchIndex() = default;
+        explicit ProfileSearchIndex (ProfileIndex sourceIndex);
+
+        size_t size() const noexcept { return numProfiles; }
+        const std::vector<ProfileIndex::Entry>& getEntries() const noexcept { return index.getEntries(); }
+
+        /** Returns up to k matches ordered from closest to farthest. */
+        std::vector<Match> findNearest (const ReferenceProfile& query, int k, const Weights& weights = {}) const;
+
+    private:
+        using Vec = juce::dsp::SIMDRegister<float>;
+
+        static std::array<float, numFeatures> getFeatures (const ReferenceProfile& profile) noexcept;
+        static std::array<float, numFeatures> getFeatureWeights (const Weights& weights) noexcept;
+
+        ProfileIndex index;
+        size_t numProfiles = 0;
+        std::array<std::vector<Vec>, numFeatures> columns;
+    };
+}
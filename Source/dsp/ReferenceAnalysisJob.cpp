@@ -0,0 +1,61 @@
+#include "ReferenceAnalysisJob.h"
+
+namespace reference_tone_matcher
+{
+    ReferenceAnalysisJob::ReferenceAnalysisJob (const juce::File& fileToAnalyse,
+                                                double targetSampleRate,
+                                                ProgressCallback onProgress,
+                                                CompletionCallback onComplete,
+                                                ProfileCache* cacheToUse)
+        : juce::ThreadPoolJob ("Reference analysis"),
+          file (fileToAnalyse),
+          sampleRate (targetSampleRate),
+          progressCallback (std::move (onProgress)),
+          completionCallback (std::move (onComplete)),
+          cache (cacheToUse)
+    {
+    }
+
+    juce::ThreadPoolJob::JobStatus ReferenceAnalysisJob::runJob()
+    {
+        ProfileCache::Key cacheKey;
+
+        if (cache != nullptr)
+        {
+            cacheKey = ProfileCache::makeKey (file, analyser.getSettingsHash (sampleRate));
+
+            ReferenceProfile cachedProfile;
+            cachedProfile.sourceName = file.getFileName();
+
+            if (cache->lookup (cacheKey, cachedProfile))
+            {
+                progress.store (1.0f);
+
+                if (completionCallback != nullptr)
+                    completionCallback (cachedProfile);
+
+                return jobHasFinished;
+            }
+        }
+
+        auto profile = analyser.analyseFile (file, sampleRate, [this] (double newProgress)
+        {
+            progress.store (static_cast<float> (newProgress));
+
+            if (progressCallback != nullptr)
+                progressCallback (static_cast<float> (newProgress));
+
+            return ! shouldExit();
+        });
+
+        if (shouldExit())
+            profile.isValid = false;
+        else if (cache != nullptr && profile.isValid)
+            cache->store (cacheKey, profile);
+
+        if (completionCallback != nullptr)
+            completionCallback (profile);
+
+        return jobHasFinished;
+    }
+}
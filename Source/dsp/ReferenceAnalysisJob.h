@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <juce_core/juce_core.h>
+
+#include "SpectrumAnalyser.h"
+#include "ProfileCache.h"
+
+namespace reference_tone_matcher
+{
+    /**
+        Thread pool job that streams a reference file through its own SpectrumAnalyser.
+        Progress is reported as the file is decoded and the job stops early when asked to exit.
+        The completion callback runs on the pool thread and receives an invalid profile on
+        failure or cancellation. When a ProfileCache is given, known files are served from it and
+        newly analysed profiles are added to it.
+    */
+    class ReferenceAnalysisJob : public juce::ThreadPoolJob
+    {
+    public:
+        using ProgressCallback = std::function<void (float progress)>;
+        using CompletionCallback = std::function<void (const ReferenceProfile& profile)>;
+
+        ReferenceAnalysisJob (const juce::File& fileToAnalyse,
+                              double targetSampleRate,
+                              ProgressCallback onProgress,
+                              CompletionCallback onComplete,
+                              ProfileCache* cacheToUse = nullptr);
+
+        JobStatus runJob() override;
+
+        float getProgress() const noexcept { return progress.load(); }
+
+    private:
+        SpectrumAnalyser analyser;
+        juce::File file;
+        double sampleRate = 44100.0;
+        ProgressCallback progressCallback;
+        CompletionCallback completionCallback;
+        ProfileCache* cache = nullptr;
+        std::atomic<float> progress { 0.0f };
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReferenceAnalysisJob)
+    };
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <juce_dsp/juce_dsp.h>
+
+namespace reference_tone_matcher
+{
+    /**
+        Moves channels in and out of the lanes of a SIMDRegister, one channel per lane, so a group
+        of channels can be processed one interleaved frame per sample.
+    */
+    struct SimdLanes
+    {
+        using Vec = juce::dsp::SIMDRegister<float>;
+        static constexpr size_t numLanes = Vec::SIMDNumElements;
+
+        /** One channel pointer per lane; nullptr leaves the lane unused. */
+        using Channels = std::array<float*, numLanes>;
+
+        /** Interleaves numFrames samples of each channel into frames. Unused lanes are filled with
+            silence, which keeps any state run on them at zero. */
+        static void pack (const Channels& channels, int numFrames, Vec* frames) noexcept
+        {
+            if (std::find (channels.begin(), channels.end(), nullptr) != channels.end())
+                std::fill (frames, frames + numFrames, Vec::expand (0.0f));
+
+            auto* interleaved = reinterpret_cast<float*> (frames);
+
+            for (size_t lane = 0; lane < numLanes; ++lane)
+                if (const float* source = channels[lane])
+                    for (size_t i = 0; i < static_cast<size_t> (numFrames); ++i)
+                        interleaved[i * numLanes + lane] = source[i];
+        }
+
+        /** Writes numFrames interleaved frames back to the channels of the used lanes. */
+        static void unpack (const Vec* frames, const Channels& channels, int numFrames) noexcept
+        {
+            const auto* interleaved = reinterpret_cast<const float*> (frames);
+
+            for (size_t lane = 0; lane < numLanes; ++lane)
+                if (float* destination = channels[lane])
+                    for (size_t i = 0; i < static_cast<size_t> (numFrames); ++i)
+                        destination[i] = interleaved[i * numLanes + lane];
+        }
+    };
+}
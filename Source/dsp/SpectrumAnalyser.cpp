@@ -1,19 +1,70 @@
 #include "SpectrumAnalyser.h"
 
+#include <atomic>
 #include <cmath>
 #include <cstring>
-#include <limits>
 
 namespace reference_tone_matcher
 {
+    SpectrumAnalyser::FrameWorker::FrameWorker()
+        : fft (fftOrder)
+    {
+        fftScratch.allocate (2 * fftSize, true);
+    }
+
     SpectrumAnalyser::SpectrumAnalyser()
     {
         formatManager.registerBasicFormats();
-        windowBuffer.setSize (1, fftSize);
-        fftScratch.allocate (2 * fftSize, true);
+        windowTable.allocate (fftSize, true);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables (windowTable.getData(), fftSize,
+                                                                  juce::dsp::WindowingFunction<float>::hann);
+
+        setNumWorkerThreads (juce::SystemStats::getNumCpuCores());
+    }
+
+    SpectrumAnalyser::~SpectrumAnalyser()
+    {
+        workerPool.reset();
+    }
+
+    void SpectrumAnalyser::setNumWorkerThreads (int numThreads)
+    {
+        numWorkerThreads = juce::jmax (1, numThreads);
+
+        // The pool is started by the first analysis that needs it, so analysers that are switched
+        // to a single thread straight away never create one.
+        workerPool.reset();
+    }
+
+    void SpectrumAnalyser::ensureWorkerPool()
+    {
+        if (numWorkerThreads <= 1)
+            return;
+
+        // The calling thread works on the first partition, so the pool only needs the remaining threads.
+        const juce::ScopedLock sl (workerPoolLock);
+        if (workerPool == nullptr)
+            workerPool = std::make_unique<juce::ThreadPool> (numWorkerThreads - 1);
+    }
+
+    juce::uint64 SpectrumAnalyser::getSettingsHash (double targetSampleRate) const
+    {
+        juce::String description;
+        description << "fftOrder=" << fftOrder << ";edges=";
+
+        for (const auto edge : AnalysisBandMap::getBandEdgesHz())
+            description << juce::String (edge, 3) << ",";
+
+        // In native mode the rate follows the file, which the content hash already covers.
+        description << ";rate=" << (sampleRateMode == SampleRateMode::native ? juce::String ("native")
+                                                                             : juce::String (targetSampleRate, 1));
+
+        return static_cast<juce::uint64> (description.hashCode64());
     }
 
-    ReferenceProfile SpectrumAnalyser::analyseFile (const juce::File& file, double targetSampleRate)
+    ReferenceProfile SpectrumAnalyser::analyseFile (const juce::File& file,
+                                                    double targetSampleRate,
+                                                    const ProgressCallback& progressCallback)
     {
         ReferenceProfile profile;
 
@@ -21,153 +72,272 @@ namespace reference_tone_matcher
             return profile;
 
         std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor (file));
-        if (reader == nullptr)
+        if (reader == nullptr || reader->lengthInSamples <= 0 || reader->numChannels == 0)
             return profile;
 
-        const int64 numSamples64 = reader->lengthInSamples;
-        const int numSamples = static_cast<int> (juce::jlimit<int64> (0, std::numeric_limits<int>::max(), numSamples64));
-        if (numSamples <= 0)
-            return profile;
+        const int numChannels = static_cast<int> (reader->numChannels);
+        const double readerSampleRate = reader->sampleRate;
+        const bool needsResampling = sampleRateMode == SampleRateMode::resampleToTarget
+                                      && targetSampleRate > 0.0
+                                      && std::abs (targetSampleRate / readerSampleRate - 1.0) > 0.01;
+        const double analysisSampleRate = needsResampling ? targetSampleRate : readerSampleRate;
 
-        juce::AudioBuffer<float> buffer (static_cast<int> (reader->numChannels), numSamples);
-        reader->read (&buffer, 0, numSamples, 0, true, true);
+        juce::AudioBuffer<float> chunk (numChannels, chunkSize);
+        juce::AudioBuffer<float> resampledChunk;
+        StreamingResampler resampler;
 
-        // Resample if required so that the analysis matches the current processing sample rate.
-        const double readerSampleRate = reader->sampleRate;
-        const double resampleRatio = (targetSampleRate > 0.0) ? (targetSampleRate / readerSampleRate) : 1.0;
+        if (needsResampling)
+        {
+            resampler.prepare (numChannels, readerSampleRate, targetSampleRate, chunkSize);
+            resampledChunk.setSize (numChannels, resampler.getMaximumOutputSize());
+        }
 
-        if (std::abs (resampleRatio - 1.0) > 0.01)
+        ensureWorkerPool();
+
+        StreamState state;
+        prepareStreamState (state, numChannels, analysisSampleRate,
+                            needsResampling ? resampler.getMaximumOutputSize() : chunkSize);
+
+        const juce::int64 totalSamples = reader->lengthInSamples;
+
+        for (juce::int64 position = 0; position < totalSamples;)
         {
-            const int resampledLength = static_cast<int> (std::ceil (numSamples * resampleRatio));
-            juce::AudioBuffer<float> resampled (buffer.getNumChannels(), resampledLength);
+            const int numThisChunk = static_cast<int> (juce::jmin<juce::int64> (chunkSize, totalSamples - position));
+            reader->read (&chunk, 0, numThisChunk, position, true, true);
 
-            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
-            {
-                juce::LagrangeInterpolator interpolator;
-                interpolator.reset();
-                const float* src = buffer.getReadPointer (ch);
-                float* dst = resampled.getWritePointer (ch);
-                int numDone = interpolator.process (resampleRatio, src, dst, resampledLength);
-                juce::ignoreUnused (numDone);
-            }
-
-            buffer = std::move (resampled);
+            if (needsResampling)
+                processChunk (state, resampledChunk, resampler.process (chunk, numThisChunk, resampledChunk));
+            else
+                processChunk (state, chunk, numThisChunk);
+
+            position += numThisChunk;
+
+            if (progressCallback != nullptr
+                && ! progressCallback (static_cast<double> (position) / static_cast<double> (totalSamples)))
+                return profile;
         }
 
-        profile = buildProfileFromBuffer (buffer, targetSampleRate > 0.0 ? targetSampleRate : readerSampleRate);
+        if (needsResampling)
+            processChunk (state, resampledChunk, resampler.flush (resampledChunk));
+
+        profile = buildProfileFromState (state);
         profile.sourceName = file.getFileName();
         profile.isValid = true;
 
         return profile;
     }
 
-    ReferenceProfile SpectrumAnalyser::buildProfileFromBuffer (juce::AudioBuffer<float>& buffer, double sampleRate) const
+    void SpectrumAnalyser::prepareStreamState (StreamState& state, int numChannels, double sampleRate, int maximumChunkSize) const
     {
-        ReferenceProfile profile;
-        profile.eqGainsDb = computeAverageBandMagnitudes (buffer, sampleRate);
-        profile.spectralSlope = computeSpectralSlope (profile.eqGainsDb);
-        profile.transientIntensity = computeTransientIntensity (buffer, sampleRate);
+        state.sampleRate = sampleRate;
+        state.bandMap = AnalysisBandMap (fftSize, sampleRate);
+        state.monoBuffer.setSize (1, fftSize + maximumChunkSize);
+        state.monoBuffer.clear();
+        state.numBuffered = 0;
+        state.numHops = 0;
+        state.energySum.fill (0.0);
+        state.sumOfSquares.assign (static_cast<size_t> (numChannels), 0.0);
+        state.numSamples = 0;
+        state.peakEnvelope = 0.0f;
+        state.sustainEnvelope = 0.0f;
+
+        state.workers.clear();
+        for (int i = 0; i < numWorkerThreads; ++i)
+            state.workers.push_back (std::make_unique<FrameWorker>());
+
+        state.hopEnergies.allocate (static_cast<size_t> ((maximumChunkSize / hopSize + 1) * 16), true);
 
-        const float highBandAverage = juce::jlimit (-24.0f, 24.0f, (profile.eqGainsDb[12] + profile.eqGainsDb[13] + profile.eqGainsDb[14] + profile.eqGainsDb[15]) * 0.25f);
-        const float midBandAverage = juce::jlimit (-24.0f, 24.0f, (profile.eqGainsDb[6] + profile.eqGainsDb[7] + profile.eqGainsDb[8]) / 3.0f);
-        profile.sparkle = juce::jlimit (0.0f, 1.0f, juce::jmap (highBandAverage - midBandAverage, -6.0f, 6.0f, 0.1f, 0.9f));
-        profile.bite = juce::jlimit (0.0f, 1.0f, juce::jmap (profile.transientIntensity, 0.1f, 0.8f, 0.2f, 0.9f));
-        profile.glue = juce::jlimit (0.0f, 1.0f, juce::jmap (profile.transientIntensity, 0.2f, 0.7f, 0.8f, 0.2f));
-        profile.crispAmount = juce::jlimit (0.0f, 1.0f, juce::jmap (profile.sparkle, 0.0f, 1.0f, 0.3f, 1.0f));
+        const float attackTime = 0.003f;
+        const float releaseTime = 0.05f;
+        state.attackCoeff = std::exp (-1.0f / (attackTime * static_cast<float> (sampleRate)));
+        state.releaseCoeff = std::exp (-1.0f / (releaseTime * static_cast<float> (sampleRate)));
+    }
 
-        float rms = 0.0f;
-        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
-            rms += buffer.getRMSLevel (ch, 0, buffer.getNumSamples());
+    void SpectrumAnalyser::processChunk (StreamState& state, const juce::AudioBuffer<float>& chunk, int numSamples) const
+    {
+        const int numChannels = chunk.getNumChannels();
+        const float channelGain = 1.0f / static_cast<float> (numChannels);
 
-        rms /= static_cast<float> (buffer.getNumChannels());
-        profile.rmsLevelDb = juce::Decibels::gainToDecibels (rms + 1.0e-6f);
+        float* mono = state.monoBuffer.getWritePointer (0, state.numBuffered);
+        juce::FloatVectorOperations::copyWithMultiply (mono, chunk.getReadPointer (0), channelGain, numSamples);
+        for (int ch = 1; ch < numChannels; ++ch)
+            juce::FloatVectorOperations::addWithMultiply (mono, chunk.getReadPointer (ch), channelGain, numSamples);
 
-        return profile;
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            const float* data = chunk.getReadPointer (ch);
+            double sum = 0.0;
+            for (int i = 0; i < numSamples; ++i)
+                sum += static_cast<double> (data[i]) * static_cast<double> (data[i]);
+
+            state.sumOfSquares[static_cast<size_t> (ch)] += sum;
+        }
+
+        updateTransientEnvelopes (state, chunk, numSamples);
+        state.numSamples += numSamples;
+        state.numBuffered += numSamples;
+
+        // Consume every complete frame, then keep the overlap for the next chunk.
+        const int numFrames = state.numBuffered >= fftSize ? 1 + (state.numBuffered - fftSize) / hopSize : 0;
+        analyseFrames (state, state.monoBuffer.getReadPointer (0), numFrames);
+
+        // Reduce in hop order so the sums are identical for any number of workers.
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            const float* bandEnergies = state.hopEnergies.getData() + frame * 16;
+            for (size_t band = 0; band < 16; ++band)
+                state.energySum[band] += static_cast<double> (bandEnergies[band]);
+        }
+
+        state.numHops += numFrames;
+
+        const int frameStart = numFrames * hopSize;
+        const int remaining = state.numBuffered - frameStart;
+        if (frameStart > 0 && remaining > 0)
+        {
+            float* writeData = state.monoBuffer.getWritePointer (0);
+            std::memmove (writeData, writeData + frameStart, sizeof (float) * static_cast<size_t> (remaining));
+        }
+
+        state.numBuffered = remaining;
     }
 
-    std::array<float, 16> SpectrumAnalyser::computeAverageBandMagnitudes (const juce::AudioBuffer<float>& buffer,
-                                                                          double sampleRate) const
+    void SpectrumAnalyser::analyseFrames (StreamState& state, const float* monoData, int numFrames) const
     {
-        std::array<float, 16> bandAveragesDb{};
-        bandAveragesDb.fill (0.0f);
+        if (numFrames <= 0)
+            return;
 
-        const int totalSamples = buffer.getNumSamples();
-        if (totalSamples < fftSize)
-            return bandAveragesDb;
+        const int numWorkers = juce::jmin (static_cast<int> (state.workers.size()), numFrames);
+        const int framesPerWorker = (numFrames + numWorkers - 1) / numWorkers;
 
-        juce::AudioBuffer<float> monoBuffer (1, totalSamples);
-        monoBuffer.clear();
-        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
-            monoBuffer.addFrom (0, 0, buffer, ch, 0, totalSamples, 1.0f / static_cast<float> (buffer.getNumChannels()));
+        auto analyseRange = [this, &state, monoData, numFrames, framesPerWorker] (int workerIndex)
+        {
+            auto& worker = *state.workers[static_cast<size_t> (workerIndex)];
+            const int firstFrame = workerIndex * framesPerWorker;
+            const int lastFrame = juce::jmin (numFrames, firstFrame + framesPerWorker);
 
-        juce::dsp::WindowingFunction<float> window (fftSize, juce::dsp::WindowingFunction<float>::hann);
-        const int hopSize = fftSize / 2;
-        const int numHops = juce::jmax (1, 1 + (totalSamples - fftSize) / hopSize);
-        if (numHops <= 0)
-            return bandAveragesDb;
+            for (int frame = firstFrame; frame < lastFrame; ++frame)
+                analyseFrame (worker, state.bandMap, monoData + frame * hopSize, state.hopEnergies.getData() + frame * 16);
+        };
 
-        std::array<float, 16> energySum{};
-        energySum.fill (0.0f);
+        if (workerPool == nullptr || numWorkers == 1)
+        {
+            analyseRange (0);
+            return;
+        }
+
+        std::atomic<int> pendingWorkers { numWorkers - 1 };
+        juce::WaitableEvent allFinished;
+
+        for (int workerIndex = 1; workerIndex < numWorkers; ++workerIndex)
+        {
+            workerPool->addJob ([&analyseRange, &pendingWorkers, &allFinished, workerIndex]
+            {
+                analyseRange (workerIndex);
+                if (--pendingWorkers == 0)
+                    allFinished.signal();
+            });
+        }
+
+        // The calling thread takes the first partition.
+        analyseRange (0);
+        allFinished.wait();
+    }
+
+    void SpectrumAnalyser::analyseFrame (FrameWorker& worker, const AnalysisBandMap& bandMap, const float* frame, float* bandPowers) const
+    {
+        // Window straight into the FFT buffer. Only the first half is read by the transform, so the
+        // upper half needs no clearing, and the negative frequencies are never looked at.
+        float* scratch = worker.fftScratch.getData();
+        juce::FloatVectorOperations::multiply (scratch, frame, windowTable.getData(), fftSize);
+        worker.fft.performRealOnlyForwardTransform (scratch, true);
 
-        float* scratch = fftScratch.getData();
+        accumulateBandPowers (bandMap, scratch, bandPowers);
+    }
 
-        std::array<double, 17> bandEdgesHz{};
-        const double minFreq = 80.0;
-        const double maxFreq = 16000.0;
-        const double ratio = std::pow (maxFreq / minFreq, 1.0 / 16.0);
-        bandEdgesHz[0] = minFreq;
-        for (size_t i = 1; i <= 16; ++i)
-            bandEdgesHz[i] = bandEdgesHz[i - 1] * ratio;
+    void SpectrumAnalyser::updateTransientEnvelopes (StreamState& state, const juce::AudioBuffer<float>& chunk, int numSamples) const
+    {
+        const int numChannels = chunk.getNumChannels();
+        float peakEnvelope = state.peakEnvelope;
+        float sustainEnvelope = state.sustainEnvelope;
 
-        for (int hop = 0; hop < numHops; ++hop)
+        for (int i = 0; i < numSamples; ++i)
         {
-            float* windowData = windowBuffer.getWritePointer (0);
-            const float* src = monoBuffer.getReadPointer (0, hop * hopSize);
-            std::memcpy (windowData, src, sizeof (float) * fftSize);
-            window.multiplyWithWindowingTable (windowData, fftSize);
+            float sample = 0.0f;
+            for (int ch = 0; ch < numChannels; ++ch)
+                sample += std::abs (chunk.getSample (ch, i));
 
-            std::fill (scratch, scratch + 2 * fftSize, 0.0f);
-            std::memcpy (scratch, windowData, sizeof (float) * fftSize);
-            fft.performRealOnlyForwardTransform (scratch);
+            sample /= static_cast<float> (numChannels);
 
-            const int spectrumSize = fftSize / 2;
-            for (int band = 0; band < 16; ++band)
-            {
-                const double lowFreq = bandEdgesHz[band];
-                const double highFreq = bandEdgesHz[band + 1];
-                const int lowBin = static_cast<int> (juce::jlimit (0.0, static_cast<double> (spectrumSize - 1), std::floor (lowFreq * fftSize / sampleRate)));
-                const int highBin = static_cast<int> (juce::jlimit (0.0, static_cast<double> (spectrumSize - 1), std::ceil (highFreq * fftSize / sampleRate)));
-                float magnitudeSum = 0.0f;
-                const int binCount = juce::jmax (1, highBin - lowBin);
-
-                for (int bin = lowBin; bin < highBin; ++bin)
-                {
-                    const float real = scratch[bin * 2];
-                    const float imag = scratch[bin * 2 + 1];
-                    magnitudeSum += std::sqrt (real * real + imag * imag);
-                }
-
-                energySum[band] += magnitudeSum / static_cast<float> (binCount);
-            }
+            if (sample > peakEnvelope)
+                peakEnvelope = state.attackCoeff * peakEnvelope + (1.0f - state.attackCoeff) * sample;
+            else
+                peakEnvelope = state.releaseCoeff * peakEnvelope + (1.0f - state.releaseCoeff) * sample;
+
+            sustainEnvelope = 0.999f * sustainEnvelope + 0.001f * sample;
+        }
+
+        state.peakEnvelope = peakEnvelope;
+        state.sustainEnvelope = sustainEnvelope;
+    }
+
+    ReferenceProfile SpectrumAnalyser::buildProfileFromState (const StreamState& state) const
+    {
+        std::array<double, 16> meanBandPowers{};
+        if (state.numHops > 0)
+            for (size_t band = 0; band < 16; ++band)
+                meanBandPowers[band] = state.energySum[band] / static_cast<double> (state.numHops);
+
+        float rms = 0.0f;
+        if (state.numSamples > 0)
+        {
+            for (const double sum : state.sumOfSquares)
+                rms += static_cast<float> (std::sqrt (sum / static_cast<double> (state.numSamples)));
+
+            rms /= static_cast<float> (state.sumOfSquares.size());
         }
 
-        const float normalisation = 1.0f / static_cast<float> (numHops);
+        return makeProfile (meanBandPowers, computeTransientIntensity (state), rms);
+    }
+
+    ReferenceProfile SpectrumAnalyser::makeProfile (const std::array<double, 16>& meanBandPowers, float transientIntensity, float rmsLevel)
+    {
+        ReferenceProfile profile;
+        profile.eqGainsDb = computeBandLevelsDb (meanBandPowers);
+        profile.spectralSlope = computeSpectralSlope (profile.eqGainsDb);
+        profile.transientIntensity = transientIntensity;
+
+        const float highBandAverage = juce::jlimit (-24.0f, 24.0f, (profile.eqGainsDb[12] + profile.eqGainsDb[13] + profile.eqGainsDb[14] + profile.eqGainsDb[15]) * 0.25f);
+        const float midBandAverage = juce::jlimit (-24.0f, 24.0f, (profile.eqGainsDb[6] + profile.eqGainsDb[7] + profile.eqGainsDb[8]) / 3.0f);
+        profile.sparkle = juce::jlimit (0.0f, 1.0f, juce::jmap (highBandAverage - midBandAverage, -6.0f, 6.0f, 0.1f, 0.9f));
+        profile.bite = juce::jlimit (0.0f, 1.0f, juce::jmap (profile.transientIntensity, 0.1f, 0.8f, 0.2f, 0.9f));
+        profile.glue = juce::jlimit (0.0f, 1.0f, juce::jmap (profile.transientIntensity, 0.2f, 0.7f, 0.8f, 0.2f));
+        profile.crispAmount = juce::jlimit (0.0f, 1.0f, juce::jmap (profile.sparkle, 0.0f, 1.0f, 0.3f, 1.0f));
+        profile.rmsLevelDb = juce::Decibels::gainToDecibels (rmsLevel + 1.0e-6f);
+
+        return profile;
+    }
+
+    std::array<float, 16> SpectrumAnalyser::computeBandLevelsDb (const std::array<double, 16>& meanBandPowers)
+    {
+        std::array<float, 16> bandLevelsDb{};
+
+        // Mean band power in, so 10 log10 yields the level of the RMS magnitude.
         float globalAverage = 0.0f;
-        for (int band = 0; band < 16; ++band)
+        for (size_t band = 0; band < 16; ++band)
         {
-            const float average = energySum[band] * normalisation + 1.0e-6f;
-            bandAveragesDb[band] = juce::Decibels::gainToDecibels (average);
-            globalAverage += bandAveragesDb[band];
+            bandLevelsDb[band] = static_cast<float> (10.0 * std::log10 (meanBandPowers[band] + 1.0e-12));
+            globalAverage += bandLevelsDb[band];
         }
 
         globalAverage /= 16.0f;
-        for (float& value : bandAveragesDb)
+        for (float& value : bandLevelsDb)
             value -= globalAverage;
 
-        return bandAveragesDb;
+        return bandLevelsDb;
     }
 
-    float SpectrumAnalyser::computeSpectralSlope (const std::array<float, 16>& bandMagnitudesDb) const
+    float SpectrumAnalyser::computeSpectralSlope (const std::array<float, 16>& bandMagnitudesDb)
     {
         double sumX = 0.0;
         double sumY = 0.0;
@@ -193,35 +363,9 @@ namespace reference_tone_matcher
         return static_cast<float> (slope);
     }
 
-    float SpectrumAnalyser::computeTransientIntensity (const juce::AudioBuffer<float>& buffer, double sampleRate) const
+    float SpectrumAnalyser::computeTransientIntensity (const StreamState& state) const
     {
-        const int numSamples = buffer.getNumSamples();
-        const float attackTime = 0.003f;
-        const float releaseTime = 0.05f;
-        const float attackCoeff = std::exp (-1.0f / (attackTime * static_cast<float> (sampleRate)));
-        const float releaseCoeff = std::exp (-1.0f / (releaseTime * static_cast<float> (sampleRate)));
-
-        float peakEnvelope = 0.0f;
-        float sustainEnvelope = 0.0f;
-
-        for (int i = 0; i < numSamples; ++i)
-        {
-            float sample = 0.0f;
-            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
-                sample += std::abs (buffer.getSample (ch, i));
-
-            sample /= static_cast<float> (buffer.getNumChannels());
-
-            if (sample > peakEnvelope)
-                peakEnvelope = attackCoeff * peakEnvelope + (1.0f - attackCoeff) * sample;
-            else
-                peakEnvelope = releaseCoeff * peakEnvelope + (1.0f - releaseCoeff) * sample;
-
-            sustainEnvelope = 0.999f * sustainEnvelope + 0.001f * sample;
-        }
-
-        const float ratio = juce::jlimit (0.0f, 1.0f, peakEnvelope / (sustainEnvelope + 1.0e-6f));
+        const float ratio = juce::jlimit (0.0f, 1.0f, state.peakEnvelope / (state.sustainEnvelope + 1.0e-6f));
         return ratio;
     }
 }
-
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "ReferenceProfile.h"
+#include "AnalysisBandMap.h"
+#include "StreamingResampler.h"
+#include <functional>
+#include <memory>
+#include <vector>
 #include <juce_audio_formats/juce_audio_formats.h>
 #include <juce_dsp/juce_dsp.h>
 
@@ -8,28 +13,104 @@ namespace reference_tone_matcher
 {
     /**
         Performs FFT based analysis for the reference file and converts results into a ReferenceProfile.
-        The analyser is lightweight enough to run on the message thread when a new file is selected.
+        The file is decoded in fixed-size chunks that are fed through the STFT incrementally, so memory use
+        stays constant regardless of the file length. Long files should be analysed off the message thread,
+        see ReferenceAnalysisJob.
+
+        The hops of each chunk are partitioned across a worker pool. Every worker owns its FFT and scratch
+        space and per-hop results are reduced in hop order, so the profile does not depend on the number
+        of threads. All per-analysis state lives on the stack of analyseFile, which makes the analyser
+        re-entrant.
+
+        By default the file is analysed at its own sample rate with the band edges mapped to that rate,
+        which yields the same profile as resampling first. Resampling to the target rate is still
+        available and streams through a StreamingResampler.
     */
     class SpectrumAnalyser
     {
     public:
+        /** Receives the progress in the range 0..1. Returning false cancels the analysis. */
+        using ProgressCallback = std::function<bool (double progress)>;
+
+        enum class SampleRateMode
+        {
+            native,             // Analyse at the file's sample rate.
+            resampleToTarget    // Convert to the target sample rate before analysing.
+        };
+
         SpectrumAnalyser();
+        ~SpectrumAnalyser();
+
+        /** Sets how many threads share the STFT work, including the calling thread. The worker
+            threads are started by the first analysis. Must not be called while an analysis is running. */
+        void setNumWorkerThreads (int numThreads);
+        int getNumWorkerThreads() const noexcept { return numWorkerThreads; }
+
+        void setSampleRateMode (SampleRateMode newMode) noexcept { sampleRateMode = newMode; }
+        SampleRateMode getSampleRateMode() const noexcept { return sampleRateMode; }
+
+        /** Hash of every setting that affects the resulting profile: FFT order, band edges and the
+            sample rate the analysis runs at. Used to key cached profiles. */
+        juce::uint64 getSettingsHash (double targetSampleRate) const;
+
+        [[nodiscard]] ReferenceProfile analyseFile (const juce::File& file,
+                                                    double targetSampleRate,
+                                                    const ProgressCallback& progressCallback = {});
 
-        [[nodiscard]] ReferenceProfile analyseFile (const juce::File& file, double targetSampleRate);
+        /** Derives a complete profile from mean band powers, a transient intensity and a linear RMS level.
+            Shared with the live profilers so every profile uses the same mapping. */
+        static ReferenceProfile makeProfile (const std::array<double, 16>& meanBandPowers, float transientIntensity, float rmsLevel);
+
+        static constexpr int fftOrder = 12;         // 4096 point FFT.
+        static constexpr int fftSize = 1 << fftOrder;
+        static constexpr int hopSize = fftSize / 2;
+        static constexpr int chunkSize = 1 << 18;   // Samples decoded per read.
 
     private:
-        ReferenceProfile buildProfileFromBuffer (juce::AudioBuffer<float>& buffer, double sampleRate) const;
-        std::array<float, 16> computeAverageBandMagnitudes (const juce::AudioBuffer<float>& buffer,
-                                                            double sampleRate) const;
-        float computeSpectralSlope (const std::array<float, 16>& bandMagnitudesDb) const;
-        float computeTransientIntensity (const juce::AudioBuffer<float>& buffer, double sampleRate) const;
+        /** FFT and scratch memory owned by a single worker thread. */
+        struct FrameWorker
+        {
+            FrameWorker();
+
+            juce::dsp::FFT fft;
+            juce::HeapBlock<float> fftScratch;
+        };
+
+        /** Running totals of an analysis that is fed one chunk at a time. */
+        struct StreamState
+        {
+            double sampleRate = 44100.0;
+            AnalysisBandMap bandMap;
+            juce::AudioBuffer<float> monoBuffer;     // Pending samples that do not yet fill a complete hop.
+            int numBuffered = 0;
+            juce::int64 numHops = 0;
+            std::array<double, 16> energySum{};
+            std::vector<double> sumOfSquares;        // Per channel, for the RMS estimate.
+            juce::int64 numSamples = 0;
+            float peakEnvelope = 0.0f;
+            float sustainEnvelope = 0.0f;
+            float attackCoeff = 0.0f;
+            float releaseCoeff = 0.0f;
+            std::vector<std::unique_ptr<FrameWorker>> workers;
+            juce::HeapBlock<float> hopEnergies;      // 16 band powers per hop of the current chunk.
+        };
+
+        void ensureWorkerPool();
+        void prepareStreamState (StreamState& state, int numChannels, double sampleRate, int maximumChunkSize) const;
+        void processChunk (StreamState& state, const juce::AudioBuffer<float>& chunk, int numSamples) const;
+        void analyseFrames (StreamState& state, const float* monoData, int numFrames) const;
+        void analyseFrame (FrameWorker& worker, const AnalysisBandMap& bandMap, const float* frame, float* bandPowers) const;
+        void updateTransientEnvelopes (StreamState& state, const juce::AudioBuffer<float>& chunk, int numSamples) const;
+        ReferenceProfile buildProfileFromState (const StreamState& state) const;
+        static std::array<float, 16> computeBandLevelsDb (const std::array<double, 16>& meanBandPowers);
+        static float computeSpectralSlope (const std::array<float, 16>& bandMagnitudesDb);
+        float computeTransientIntensity (const StreamState& state) const;
 
         juce::AudioFormatManager formatManager;
-        static constexpr int fftOrder = 12;      // 4096 point FFT.
-        static constexpr int fftSize = 1 << fftOrder;
-        mutable juce::dsp::FFT fft { fftOrder };
-        mutable juce::AudioBuffer<float> windowBuffer;
-        mutable juce::HeapBlock<float> fftScratch;
+        juce::HeapBlock<float> windowTable;
+        int numWorkerThreads = 1;
+        SampleRateMode sampleRateMode = SampleRateMode::native;
+        std::unique_ptr<juce::ThreadPool> workerPool;     // Created on the first multi-threaded analysis.
+        juce::CriticalSection workerPoolLock;
     };
 }
-
@@ -0,0 +1,106 @@
+#include "StreamingResampler.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace reference_tone_matcher
+{
+    namespace
+    {
+        // The interpolator may need this many samples beyond the integer read position.
+        constexpr int interpolatorLookahead = 2;
+    }
+
+    void StreamingResampler::prepare (int numChannels, double sourceSampleRate, double targetSampleRate, int maximumInputChunkSize)
+    {
+        jassert (numChannels > 0 && sourceSampleRate > 0.0 && targetSampleRate > 0.0);
+
+        speedRatio = sourceSampleRate / targetSampleRate;
+        maximumInputSize = maximumInputChunkSize;
+
+        const int maximumCarry = interpolatorLookahead + static_cast<int> (std::ceil (speedRatio)) + 1;
+        pendingInput.setSize (numChannels, maximumInputSize + maximumCarry);
+        maximumOutputSize = static_cast<int> (std::ceil (static_cast<double> (pendingInput.getNumSamples()) / speedRatio)) + 1;
+
+        interpolators.resize (static_cast<size_t> (numChannels));
+        reset();
+    }
+
+    void StreamingResampler::reset() noexcept
+    {
+        for (auto& interpolator : interpolators)
+            interpolator.reset();
+
+        pendingInput.clear();
+        numPending = 0;
+        totalInput = 0;
+        totalOutput = 0;
+    }
+
+    int StreamingResampler::process (const juce::AudioBuffer<float>& input, int numInputSamples, juce::AudioBuffer<float>& output)
+    {
+        jassert (numInputSamples <= maximumInputSize);
+        jassert (input.getNumChannels() >= pendingInput.getNumChannels());
+        jassert (output.getNumSamples() >= maximumOutputSize);
+
+        const int numChannels = pendingInput.getNumChannels();
+        for (int ch = 0; ch < numChannels; ++ch)
+            pendingInput.copyFrom (ch, numPending, input, ch, 0, numInputSamples);
+
+        numPending += numInputSamples;
+        totalInput += numInputSamples;
+
+        // Only produce what the pending input fully covers; the rest waits for the next chunk.
+        const int numOutput = juce::jlimit (0, maximumOutputSize,
+                                            static_cast<int> (std::floor (static_cast<double> (numPending - interpolatorLookahead) / speedRatio)));
+        if (numOutput == 0)
+            return 0;
+
+        int numConsumed = 0;
+        for (int ch = 0; ch < numChannels; ++ch)
+            numConsumed = interpolators[static_cast<size_t> (ch)].process (speedRatio,
+                                                                          pendingInput.getReadPointer (ch),
+                                                                          output.getWritePointer (ch),
+                                                                          numOutput);
+
+        numConsumed = juce::jmin (numConsumed, numPending);
+        const int remaining = numPending - numConsumed;
+
+        if (remaining > 0 && numConsumed > 0)
+        {
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                float* data = pendingInput.getWritePointer (ch);
+                std::memmove (data, data + numConsumed, sizeof (float) * static_cast<size_t> (remaining));
+            }
+        }
+
+        numPending = remaining;
+        totalOutput += numOutput;
+        return numOutput;
+    }
+
+    int StreamingResampler::flush (juce::AudioBuffer<float>& output)
+    {
+        jassert (output.getNumSamples() >= maximumOutputSize);
+
+        // Every input sample is owed the output up to its position; the zeros after the last one
+        // only give the interpolator something to read.
+        const auto owed = static_cast<juce::int64> (std::ceil (static_cast<double> (totalInput) / speedRatio)) - totalOutput;
+        const int numOutput = static_cast<int> (juce::jlimit<juce::int64> (0, maximumOutputSize, owed));
+
+        if (numOutput > 0)
+        {
+            pendingInput.clear (numPending, pendingInput.getNumSamples() - numPending);
+
+            for (int ch = 0; ch < pendingInput.getNumChannels(); ++ch)
+                interpolators[static_cast<size_t> (ch)].process (speedRatio,
+                                                                 pendingInput.getReadPointer (ch),
+                                                                 output.getWritePointer (ch),
+                                                                 numOutput);
+        }
+
+        reset();
+        return numOutput;
+    }
+}
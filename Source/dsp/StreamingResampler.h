@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <juce_audio_basics/juce_audio_basics.h>
+
+namespace reference_tone_matcher
+{
+    /**
+        Converts the sample rate of a multichannel stream chunk by chunk.
+        Input that cannot be consumed yet is carried over to the next call, so arbitrarily long
+        streams are resampled with memory proportional to the chunk size only.
+    */
+    class StreamingResampler
+    {
+    public:
+        StreamingResampler() = default;
+
+        void prepare (int numChannels, double sourceSampleRate, double targetSampleRate, int maximumInputChunkSize);
+        void reset() noexcept;
+
+        /** Returns the largest number of samples a single process call can produce. */
+        int getMaximumOutputSize() const noexcept { return maximumOutputSize; }
+
+        /** Consumes numInputSamples from input and writes the resampled samples to the start of output.
+            Returns the number of output samples written. */
+        int process (const juce::AudioBuffer<float>& input, int numInputSamples, juce::AudioBuffer<float>& output);
+
+        /** Ends the stream: zero-pads the carried-over input, writes the output still owed for it to
+            the start of output and resets. Returns the number of output samples written. */
+        int flush (juce::AudioBuffer<float>& output);
+
+    private:
+        double speedRatio = 1.0;                     // Input samples per output sample.
+        int maximumInputSize = 0;
+        int maximumOutputSize = 0;
+        int numPending = 0;
+        juce::int64 totalInput = 0;
+        juce::int64 totalOutput = 0;
+        juce::AudioBuffer<float> pendingInput;
+        std::vector<juce::LagrangeInterpolator> interpolators;
+    };
+}
@@ -0,0 +1,116 @@
+#include "TanhShaper.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace reference_tone_matcher
+{
+    namespace
+    {
+        // Rational fit of log cosh (x) = s P(s) / Q(s), s = x^2, on |x| <= 6. Beyond that log cosh has
+        // a slope of one to within 1e-5, so it is continued linearly from the fit.
+        constexpr double logCoshRange = 6.0;
+        constexpr double p0 = 4.9999655239e-01, p1 = 1.9887761329e-01, p2 = 1.8670643356e-02,
+                         p3 = 3.9319996698e-04, p4 = 8.3518638877e-07;
+        constexpr double q1 = 5.6438383972e-01, q2 = 8.7032148325e-02, q3 = 3.6286562161e-03,
+                         q4 = 2.7779620775e-05;
+    }
+
+    float TanhShaper::tanh (float x) noexcept
+    {
+        const float clamped = std::min (clipLevel, std::max (-clipLevel, x));
+        const float s = clamped * clamped;
+
+        return clamped * (135135.0f + s * (17325.0f + s * (378.0f + s)))
+                       / (135135.0f + s * (62370.0f + s * (3150.0f + 28.0f * s)));
+    }
+
+    double TanhShaper::logCosh (double x) noexcept
+    {
+        const double magnitude = std::abs (x);
+        const double a = std::min (magnitude, logCoshRange);
+        const double s = a * a;
+
+        return s * (p0 + s * (p1 + s * (p2 + s * (p3 + s * p4))))
+                 / (1.0 + s * (q1 + s * (q2 + s * (q3 + s * q4))))
+             + (magnitude - a);
+    }
+
+    void TanhShaper::processTanh (float* data, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            data[i] = tanh (data[i]);
+    }
+
+    void TanhShaper::prepare (int numChannels, int maximumBlockSize)
+    {
+        previousInput.assign (static_cast<size_t> (juce::jmax (0, numChannels)), 0.0f);
+        previousAntiderivative.assign (previousInput.size(), 0.0);
+        inputScratch.assign (static_cast<size_t> (juce::jmax (1, maximumBlockSize)) + 1, 0.0f);
+        antiderivativeScratch.assign (inputScratch.size(), 0.0);
+    }
+
+    void TanhShaper::reset() noexcept
+    {
+        std::fill (previousInput.begin(), previousInput.end(), 0.0f);
+        std::fill (previousAntiderivative.begin(), previousAntiderivative.end(), logCosh (0.0));
+    }
+
+    void TanhShaper::setAntiderivativeAntiAliasing (bool shouldUseAntiAliasing) noexcept
+    {
+        if (shouldUseAntiAliasing != useAntiAliasing)
+        {
+            useAntiAliasing = shouldUseAntiAliasing;
+            reset();
+        }
+    }
+
+    void TanhShaper::process (juce::dsp::AudioBlock<float>& block) noexcept
+    {
+        const auto numChannels = useAntiAliasing ? juce::jmin (block.getNumChannels(), previousInput.size())
+                                                 : block.getNumChannels();
+        const auto maxChunk = static_cast<int> (inputScratch.size()) - 1;
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+        {
+            float* data = block.getChannelPointer (ch);
+            const auto numSamples = static_cast<int> (block.getNumSamples());
+
+            if (! useAntiAliasing)
+            {
+                processTanh (data, numSamples);
+                continue;
+            }
+
+            for (int start = 0; start < numSamples; start += maxChunk)
+                processAntiAliased (data + start, juce::jmin (maxChunk, numSamples - start), ch);
+        }
+    }
+
+    void TanhShaper::processAntiAliased (float* data, int numSamples, size_t channel) noexcept
+    {
+        float* inputs = inputScratch.data();
+        double* antiderivatives = antiderivativeScratch.data();
+
+        // Pass one: shifted copy of the input and F of every sample.
+        inputs[0] = previousInput[channel];
+        antiderivatives[0] = previousAntiderivative[channel];
+        std::copy (data, data + numSamples, inputs + 1);
+
+        for (int i = 1; i <= numSamples; ++i)
+            antiderivatives[i] = logCosh (static_cast<double> (inputs[i]));
+
+        // Pass two: divided differences, or f at the midpoint where the step is too small.
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float step = inputs[i + 1] - inputs[i];
+            const bool isSmallStep = std::abs (step) < minimumStep;
+            const auto divided = static_cast<float> ((antiderivatives[i + 1] - antiderivatives[i]) / (isSmallStep ? 1.0f : step));
+            const float midpoint = tanh (0.5f * (inputs[i + 1] + inputs[i]));
+            data[i] = isSmallStep ? midpoint : divided;
+        }
+
+        previousInput[channel] = inputs[numSamples];
+        previousAntiderivative[channel] = antiderivatives[numSamples];
+    }
+}
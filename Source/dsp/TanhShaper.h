@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <juce_dsp/juce_dsp.h>
+
+namespace reference_tone_matcher
+{
+    /**
+        Fast tanh waveshaper with optional first-order antiderivative anti-aliasing (ADAA).
+
+        Audio thread only; the error stays below maximumError. ADAA adds half a sample of delay.
+    */
+    class TanhShaper
+    {
+    public:
+        static constexpr float clipLevel = 4.97f;
+        static constexpr float maximumError = 1.0e-4f;
+
+        TanhShaper() = default;
+
+        /** maximumBlockSize is in samples at the rate the shaper runs at, i.e. after oversampling. */
+        void prepare (int numChannels, int maximumBlockSize);
+        void reset() noexcept;
+        void setAntiderivativeAntiAliasing (bool shouldUseAntiAliasing) noexcept;
+        bool isUsingAntiderivativeAntiAliasing() const noexcept { return useAntiAliasing; }
+
+        void process (juce::dsp::AudioBlock<float>& block) noexcept;
+
+        static float tanh (float x) noexcept;
+        static double logCosh (double x) noexcept;
+
+        /** Applies the approximated tanh in place. */
+        static void processTanh (float* data, int numSamples) noexcept;
+
+    private:
+        void processAntiAliased (float* data, int numSamples, size_t channel) noexcept;
+
+        // Below this input step the divided difference is replaced by f at the midpoint, which keeps
+        // rounding in F from being amplified. Both stay within maximumError of exact ADAA; the largest
+        // deviation, about 9.6e-5, is the tanh approximation itself just below clipLevel.
+        static constexpr float minimumStep = 1.0e-2f;
+
+        bool useAntiAliasing = false;
+        std::vector<float> previousInput;           // Per channel.
+        std::vector<double> previousAntiderivative; // Per channel.
+        std::vector<float> inputScratch;            // Previous input followed by the block.
+        std::vector<double> antiderivativeScratch;  // F of the values in inputScratch.
+    };
+}
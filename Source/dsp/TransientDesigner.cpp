@@ -5,61 +5,146 @@
 
 namespace reference_tone_matcher
 {
+    namespace
+    {
+        juce::dsp::SIMDRegister<float> makeEnvelopeGain (double timeSeconds, double sampleRate)
+        {
+            return juce::dsp::SIMDRegister<float>::expand (static_cast<float> (1.0 - std::exp (-1.0 / (timeSeconds * sampleRate))));
+        }
+    }
+
     void TransientDesigner::prepare (const juce::dsp::ProcessSpec& spec)
     {
-        currentSpec = spec;
-        const size_t totalSamples = spec.maximumBlockSize * spec.numChannels;
-        envelopeFast.resize (totalSamples);
-        envelopeSlow.resize (totalSamples);
+        numChannels = static_cast<int> (spec.numChannels);
+        maximumBlockSize = juce::jmax (1, static_cast<int> (spec.maximumBlockSize));
+
+        // Attacks must stay faster than releases, which lets process pick between them with a max.
+        fastAttack = makeEnvelopeGain (0.001, spec.sampleRate);
+        fastRelease = makeEnvelopeGain (0.02, spec.sampleRate);
+        slowAttack = makeEnvelopeGain (0.01, spec.sampleRate);
+        slowRelease = makeEnvelopeGain (0.2, spec.sampleRate);
+
+        const auto lanes = static_cast<int> (Vec::size());
+        const auto numGroups = static_cast<size_t> ((numChannels + lanes - 1) / lanes);
+        envelopeFast.assign (numGroups, Vec::expand (0.0f));
+        envelopeSlow.assign (numGroups, Vec::expand (0.0f));
+        frames.assign (static_cast<size_t> (maximumBlockSize), Vec::expand (0.0f));
+        linkedLevels.assign (static_cast<size_t> (maximumBlockSize), 0.0f);
+
+        rampLength = juce::jmax (1, juce::roundToInt (spec.sampleRate * amountRampSeconds));
+        amount = targetAmount;
+        rampRemaining = 0;
+
         reset();
     }
 
     void TransientDesigner::reset() noexcept
     {
-        std::fill (envelopeFast.begin(), envelopeFast.end(), 0.0f);
-        std::fill (envelopeSlow.begin(), envelopeSlow.end(), 0.0f);
+        std::fill (envelopeFast.begin(), envelopeFast.end(), Vec::expand (0.0f));
+        std::fill (envelopeSlow.begin(), envelopeSlow.end(), Vec::expand (0.0f));
+        envelopesNeedSeeding = true;
     }
 
     void TransientDesigner::setAmount (float biteAmount) noexcept
     {
         bite = juce::jlimit (0.0f, 1.0f, biteAmount);
+
+        const float newTarget = juce::jmap (bite, 0.0f, 1.0f, 0.0f, 0.6f);
+        if (newTarget != targetAmount)
+        {
+            targetAmount = newTarget;
+            rampRemaining = rampLength;
+        }
     }
 
     void TransientDesigner::process (juce::dsp::AudioBlock<float>& block) noexcept
     {
-        if (block.getNumSamples() == 0)
-            return;
+        const int blockChannels = juce::jmin (numChannels, static_cast<int> (block.getNumChannels()));
+        const int numSamples = static_cast<int> (block.getNumSamples());
+        const int lanes = static_cast<int> (Vec::size());
 
-        const float fastAttack = std::exp (-1.0f / (0.001f * static_cast<float> (currentSpec.sampleRate)));
-        const float fastRelease = std::exp (-1.0f / (0.02f * static_cast<float> (currentSpec.sampleRate)));
-        const float slowAttack = std::exp (-1.0f / (0.01f * static_cast<float> (currentSpec.sampleRate)));
-        const float slowRelease = std::exp (-1.0f / (0.2f * static_cast<float> (currentSpec.sampleRate)));
+        if (numSamples == 0 || blockChannels == 0)
+            return;
 
-        const float amount = juce::jmap (bite, 0.0f, 1.0f, 0.0f, 0.6f);
+        // Neutral: nothing to add, so the envelopes are not worth running either.
+        if (amount == 0.0f && targetAmount == 0.0f)
+        {
+            envelopesNeedSeeding = true;
+            return;
+        }
 
-        size_t idx = 0;
-        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        for (int start = 0; start < numSamples; start += maximumBlockSize)
         {
-            auto channelBlock = block.getSingleChannelBlock (channel);
-            auto* data = channelBlock.getChannelPointer();
+            const int numFrames = juce::jmin (maximumBlockSize, numSamples - start);
+            const int numRampFrames = juce::jmin (rampRemaining, numFrames);
+            const float amountStep = rampRemaining > 0 ? (targetAmount - amount) / static_cast<float> (rampRemaining) : 0.0f;
 
-            for (size_t sample = 0; sample < channelBlock.getNumSamples(); ++sample)
+            if (stereoLink)
             {
-                const float input = std::abs (data[sample]);
-                auto& fastEnv = envelopeFast[idx];
-                auto& slowEnv = envelopeSlow[idx];
+                std::fill (linkedLevels.begin(), linkedLevels.begin() + numFrames, 0.0f);
+
+                for (int channel = 0; channel < blockChannels; ++channel)
+                {
+                    const float* source = block.getChannelPointer (static_cast<size_t> (channel)) + start;
+                    for (int i = 0; i < numFrames; ++i)
+                        linkedLevels[static_cast<size_t> (i)] = juce::jmax (linkedLevels[static_cast<size_t> (i)], std::abs (source[i]));
+                }
+            }
 
-                fastEnv = (input > fastEnv) ? fastAttack * fastEnv + (1.0f - fastAttack) * input
-                                            : fastRelease * fastEnv + (1.0f - fastRelease) * input;
+            for (int firstChannel = 0; firstChannel < blockChannels; firstChannel += lanes)
+            {
+                const int numInGroup = juce::jmin (lanes, blockChannels - firstChannel);
 
-                slowEnv = (input > slowEnv) ? slowAttack * slowEnv + (1.0f - slowAttack) * input
-                                            : slowRelease * slowEnv + (1.0f - slowRelease) * input;
+                SimdLanes::Channels channels{};
+                for (int lane = 0; lane < numInGroup; ++lane)
+                    channels[static_cast<size_t> (lane)] = block.getChannelPointer (static_cast<size_t> (firstChannel + lane)) + start;
 
-                const float diff = juce::jlimit (-1.0f, 1.0f, fastEnv - slowEnv);
-                data[sample] += amount * diff * data[sample];
-                ++idx;
+                SimdLanes::pack (channels, numFrames, frames.data());
+                processFrames (static_cast<size_t> (firstChannel / lanes), numFrames, amount, amountStep, numRampFrames);
+                SimdLanes::unpack (frames.data(), channels, numFrames);
             }
+
+            envelopesNeedSeeding = false;
+            rampRemaining -= numRampFrames;
+            amount = rampRemaining == 0 ? targetAmount : amount + amountStep * static_cast<float> (numRampFrames);
         }
     }
-}
 
+    void TransientDesigner::processFrames (size_t group, int numFrames, float startAmount, float amountStep, int numRampFrames) noexcept
+    {
+        const auto one = Vec::expand (1.0f);
+        const auto minusOne = Vec::expand (-1.0f);
+
+        auto fastEnvelope = envelopeFast[group];
+        auto slowEnvelope = envelopeSlow[group];
+
+        // Start both envelopes on the current level, so their difference begins at zero.
+        if (envelopesNeedSeeding)
+        {
+            fastEnvelope = stereoLink ? Vec::expand (linkedLevels[0]) : Vec::abs (frames[0]);
+            slowEnvelope = fastEnvelope;
+        }
+
+        for (size_t i = 0; i < static_cast<size_t> (numFrames); ++i)
+        {
+            const auto input = frames[i];
+            const auto level = stereoLink ? Vec::expand (linkedLevels[i]) : Vec::abs (input);
+
+            // Rising, the faster attack moves further; falling, the slower release stays higher.
+            // Either way the max selects the right one without a branch per lane.
+            const auto fastDelta = level - fastEnvelope;
+            fastEnvelope += Vec::max (fastDelta * fastAttack, fastDelta * fastRelease);
+
+            const auto slowDelta = level - slowEnvelope;
+            slowEnvelope += Vec::max (slowDelta * slowAttack, slowDelta * slowRelease);
+
+            const float frameAmount = static_cast<int> (i) < numRampFrames ? startAmount + amountStep * static_cast<float> (i + 1)
+                                                                           : targetAmount;
+            const auto difference = Vec::min (one, Vec::max (minusOne, fastEnvelope - slowEnvelope));
+            frames[i] = input + Vec::expand (frameAmount) * difference * input;
+        }
+
+        envelopeFast[group] = fastEnvelope;
+        envelopeSlow[group] = slowEnvelope;
+    }
+}
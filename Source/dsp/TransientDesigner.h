@@ -1,27 +1,58 @@
 #pragma once
 
+#include <vector>
 #include <juce_dsp/juce_dsp.h>
 
+#include "SimdLanes.h"
+
 namespace reference_tone_matcher
 {
     /**
-        Simple transient shaper emphasising attacks using dual envelope followers.
+        Transient shaper emphasising attacks using dual envelope followers.
+
+        Each channel keeps one continuous fast and one slow envelope. Channels are packed into the lanes
+        of a SIMDRegister like in BiquadCascade, so a stereo signal runs through a single vector loop.
+        With stereo linking every channel is driven by the loudest channel, which keeps the stereo image
+        steady on one-sided transients. Coefficients are computed and memory is allocated in prepare.
+
+        Changes of the amount are ramped. At bite = 0 the shaper contributes nothing, so once the
+        ramp has reached zero the block is left untouched without running the envelopes. When it
+        comes back, the envelopes start settled on the current level rather than from silence.
     */
     class TransientDesigner
     {
     public:
+        using Vec = juce::dsp::SIMDRegister<float>;
+
         TransientDesigner() = default;
 
         void prepare (const juce::dsp::ProcessSpec& spec);
         void reset() noexcept;
         void setAmount (float biteAmount) noexcept;
+        void setStereoLink (bool shouldLink) noexcept { stereoLink = shouldLink; }
         void process (juce::dsp::AudioBlock<float>& block) noexcept;
 
     private:
-        juce::dsp::ProcessSpec currentSpec{};
+        void processFrames (size_t group, int numFrames, float startAmount, float amountStep, int numRampFrames) noexcept;
+
+        static constexpr double amountRampSeconds = 0.01;
+
         float bite = 0.5f;
-        std::vector<float> envelopeFast;
-        std::vector<float> envelopeSlow;
+        float amount = 0.0f;                // Gain applied to the envelope difference.
+        float targetAmount = 0.3f;
+        int rampLength = 1;
+        int rampRemaining = 0;
+        bool envelopesNeedSeeding = true;
+        bool stereoLink = false;
+
+        // One-pole gains, 1 - exp (-1 / (time * sampleRate)), repeated in every lane.
+        Vec fastAttack, fastRelease, slowAttack, slowRelease;
+
+        int numChannels = 0;
+        int maximumBlockSize = 0;
+        std::vector<Vec> envelopeFast;      // One entry per channel group.
+        std::vector<Vec> envelopeSlow;
+        std::vector<Vec> frames;            // One interleaved frame of a channel group per sample.
+        std::vector<float> linkedLevels;    // Loudest channel per sample, used when linked.
     };
 }
-
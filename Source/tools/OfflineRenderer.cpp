@@ -0,0 +1,356 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+#include <juce_core/juce_core.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include "../dsp/ProcessingChain.h"
+#include "../dsp/ProfileCache.h"
+#include "../dsp/ReferenceAnalysisJob.h"
+
+/**
+    Renders audio files through the plug-in's processing chain without a host, matched to a
+    reference. The reference is analysed once, or loaded from the profile cache the plug-in shares,
+    and every input file is then streamed through its own chain on a pool thread, in large blocks
+    read and written one chunk at a time. Output files are latency compensated and written as WAV.
+
+    Files found in a directory keep their path below it, including the directory's own name, so
+    a/mix.wav and b/mix.wav end up in different places. Any output name that is still taken, such
+    as mix.flac next to mix.wav, gets a numbered suffix and a warning.
+
+    Usage: OfflineRenderer <referenceFile> <outputDirectory> <input files or directories...>
+                           [--threads=N] [--block=N] [--bits=16|24|32] [--wet=0..1] [--bands=2..6]
+                           [--lookahead=ms] [--linear-phase] [--low-latency] [--profile-crossovers]
+*/
+namespace
+{
+    using reference_tone_matcher::ProcessingChain;
+    using reference_tone_matcher::ReferenceProfile;
+
+    // Matched with File::hasFileExtension, which ignores case, so "*.WAV" files are found on Linux too.
+    constexpr const char* audioFileExtensions = "wav;flac;mp3;aif;aiff";
+
+    /** Outcome of one file, filled in by its job. */
+    struct RenderResult
+    {
+        juce::File input;
+        juce::File output;
+        double audioSeconds = 0.0;
+        double elapsedSeconds = 0.0;
+        juce::String error;
+    };
+
+    /** Streams one file through a private chain and writes the result. */
+    class RenderFileJob : public juce::ThreadPoolJob
+    {
+    public:
+        RenderFileJob (RenderResult& resultToFill, const ReferenceProfile& profileToUse,
+                       const ProcessingChain::Settings& settingsToUse, int blockSizeToUse, int bitsPerSampleToUse,
+                       std::atomic<int>& finishedCounter, juce::WaitableEvent& finishedEvent)
+            : juce::ThreadPoolJob ("Render " + resultToFill.input.getFileName()),
+              result (resultToFill),
+              profile (profileToUse),
+              settings (settingsToUse),
+              blockSize (blockSizeToUse),
+              bitsPerSample (bitsPerSampleToUse),
+              numFinished (finishedCounter),
+              jobFinished (finishedEvent)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            const auto startTime = juce::Time::getMillisecondCounterHiRes();
+            render();
+            result.elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) * 0.001;
+            ++numFinished;
+            jobFinished.signal();
+
+            return jobHasFinished;
+        }
+
+    private:
+        void render()
+        {
+            juce::AudioFormatManager formatManager;
+            formatManager.registerBasicFormats();
+
+            std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor (result.input));
+            if (reader == nullptr)
+            {
+                result.error = "unreadable";
+                return;
+            }
+
+            const auto numChannels = static_cast<int> (reader->numChannels);
+            const auto length = reader->lengthInSamples;
+            result.audioSeconds = static_cast<double> (length) / reader->sampleRate;
+
+            result.output.deleteFile();
+            result.output.getParentDirectory().createDirectory();
+            auto stream = result.output.createOutputStream();
+            if (stream == nullptr)
+            {
+                result.error = "cannot write " + result.output.getFullPathName();
+                return;
+            }
+
+            std::unique_ptr<juce::AudioFormatWriter> writer (juce::WavAudioFormat().createWriterFor (stream.get(), reader->sampleRate,
+                                                                                                      reader->numChannels, bitsPerSample,
+                                                                                                      {}, 0));
+            if (writer == nullptr)
+            {
+                result.error = "unsupported output format";
+                return;
+            }
+
+            stream.release();
+
+            ProcessingChain chain;
+            chain.setSettings (settings);
+            chain.prepare (reader->sampleRate, blockSize, numChannels);
+            chain.setReferenceProfile (profile);
+
+            // The chain is run past the end of the file by its latency, which is then dropped from the
+            // start, so the output lines up with the input. Reads beyond the end return silence.
+            const auto latency = static_cast<juce::int64> (chain.getLatencySamples());
+            juce::AudioBuffer<float> buffer (numChannels, blockSize);
+
+            for (juce::int64 position = 0; position < length + latency; position += blockSize)
+            {
+                if (shouldExit())
+                {
+                    result.error = "cancelled";
+                    return;
+                }
+
+                const auto numSamples = static_cast<int> (juce::jmin (static_cast<juce::int64> (blockSize), length + latency - position));
+                reader->read (&buffer, 0, numSamples, position, true, true);
+
+                chain.designPendingCoefficients();
+                auto block = juce::dsp::AudioBlock<float> (buffer).getSubBlock (0, static_cast<size_t> (numSamples));
+                chain.process (block);
+
+                const auto skip = static_cast<int> (juce::jlimit (static_cast<juce::int64> (0), static_cast<juce::int64> (numSamples), latency - position));
+                if (skip < numSamples && ! writer->writeFromAudioSampleBuffer (buffer, skip, numSamples - skip))
+                {
+                    result.error = "write failed";
+                    return;
+                }
+            }
+        }
+
+        RenderResult& result;
+        const ReferenceProfile& profile;
+        const ProcessingChain::Settings& settings;
+        const int blockSize;
+        const int bitsPerSample;
+        std::atomic<int>& numFinished;
+        juce::WaitableEvent& jobFinished;
+    };
+
+    ReferenceProfile loadReferenceProfile (const juce::File& referenceFile)
+    {
+        reference_tone_matcher::ProfileCache cache (reference_tone_matcher::ProfileCache::getDefaultCacheFile());
+        ReferenceProfile profile;
+
+        // The same job the plug-in uses, so a reference it has seen before comes from the cache.
+        reference_tone_matcher::ReferenceAnalysisJob job (referenceFile, 0.0, {},
+                                                          [&profile] (const ReferenceProfile& analysed) { profile = analysed; },
+                                                          &cache);
+        juce::ThreadPool pool (1);
+        pool.addJob (&job, false);
+        pool.waitForJobToFinish (&job, -1);
+
+        return profile;
+    }
+
+    /** Returns wanted, or the first free name with " (2)", " (3)", ... appended, and marks it taken.
+        Names are compared case-insensitively, as some file systems do. */
+    juce::File claimOutputFile (const juce::File& wanted, std::set<juce::String>& takenPaths)
+    {
+        auto candidate = wanted;
+        for (int suffix = 2; ! takenPaths.insert (candidate.getFullPathName().toLowerCase()).second; ++suffix)
+            candidate = wanted.getSiblingFile (wanted.getFileNameWithoutExtension() + " (" + juce::String (suffix) + ")"
+                                               + wanted.getFileExtension());
+
+        return candidate;
+    }
+
+    ProcessingChain::Settings makeSettings (const juce::ArgumentList& args, const ReferenceProfile& profile)
+    {
+        ProcessingChain::Settings settings;
+        settings.applyProfile (profile);
+
+        if (args.containsOption ("--wet"))
+            settings.wet = juce::jlimit (0.0f, 1.0f, args.getValueForOption ("--wet").getFloatValue());
+
+        if (args.containsOption ("--bands"))
+            settings.dynamicsBands = args.getValueForOption ("--bands").getIntValue();
+
+        if (args.containsOption ("--lookahead"))
+            settings.dynamicsLookaheadMs = args.getValueForOption ("--lookahead").getFloatValue();
+
+        settings.linearPhase = args.containsOption ("--linear-phase");
+        settings.lowLatency = args.containsOption ("--low-latency");
+        settings.profileCrossovers = args.containsOption ("--profile-crossovers");
+
+        return settings;
+    }
+
+    int runRenderer (const juce::ArgumentList& args)
+    {
+        if (args.size() < 3)
+        {
+            std::cout << "Usage: OfflineRenderer <referenceFile> <outputDirectory> <input files or directories...>" << std::endl
+                      << "       [--threads=N] [--block=N] [--bits=16|24|32] [--wet=0..1] [--bands=2..6]" << std::endl
+                      << "       [--lookahead=ms] [--linear-phase] [--low-latency] [--profile-crossovers]" << std::endl;
+            return 1;
+        }
+
+        const auto referenceFile = args[0].resolveAsExistingFile();
+        const auto outputDirectory = args[1].resolveAsFile();
+        const int numThreads = args.containsOption ("--threads") ? juce::jmax (1, args.getValueForOption ("--threads").getIntValue())
+                                                                 : juce::SystemStats::getNumCpuCores();
+        const int blockSize = args.containsOption ("--block") ? juce::jmax (ProcessingChain::tileSize, args.getValueForOption ("--block").getIntValue())
+                                                              : 1 << 16;
+        const int bitsPerSample = args.containsOption ("--bits") ? args.getValueForOption ("--bits").getIntValue() : 24;
+
+        // Checked here rather than by the writer, which would fail every file only after the analysis.
+        if (bitsPerSample != 16 && bitsPerSample != 24 && bitsPerSample != 32)
+        {
+            std::cout << "Unsupported --bits=" << args.getValueForOption ("--bits") << ", use 16, 24 or 32" << std::endl;
+            return 1;
+        }
+
+        if (! outputDirectory.createDirectory())
+        {
+            std::cout << "Could not create " << outputDirectory.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        // Options start with a dash, everything else after the first two arguments is input. Each
+        // file is paired with the path it keeps below the output directory.
+        std::vector<std::pair<juce::File, juce::String>> inputs;
+        std::set<juce::String> takenPaths;
+        for (int i = 2; i < args.size(); ++i)
+        {
+            if (args[i].isOption())
+                continue;
+
+            const auto input = args[i].resolveAsFile();
+            juce::Array<juce::File> files;
+
+            if (input.isDirectory())
+                for (const auto& item : juce::RangedDirectoryIterator (input, true, "*", juce::File::findFiles))
+                    if (item.getFile().hasFileExtension (audioFileExtensions))
+                        files.add (item.getFile());
+            else if (input.existsAsFile())
+                files.add (input);
+            else
+                std::cout << "Skipping " << input.getFullPathName() << ", not found" << std::endl;
+
+            // Inputs count as taken output names too, so nothing is rendered over its own source.
+            for (const auto& file : files)
+            {
+                if (! takenPaths.insert (file.getFullPathName().toLowerCase()).second)
+                {
+                    std::cout << "Skipping " << file.getFullPathName() << ", given more than once" << std::endl;
+                    continue;
+                }
+
+                inputs.emplace_back (file, input.isDirectory() ? file.getRelativePathFrom (input.getParentDirectory())
+                                                               : file.getFileName());
+            }
+        }
+
+        // Output names are settled before any job runs, so no two jobs write the same file.
+        std::vector<RenderResult> results;
+        for (const auto& [file, relativePath] : inputs)
+        {
+            const auto wanted = outputDirectory.getChildFile (relativePath).withFileExtension ("wav");
+
+            RenderResult result;
+            result.input = file;
+            result.output = claimOutputFile (wanted, takenPaths);
+
+            if (result.output != wanted)
+                std::cout << "Warning: " << wanted.getFullPathName() << " is already taken, rendering "
+                          << file.getFullPathName() << " to " << result.output.getFileName() << std::endl;
+
+            results.push_back (std::move (result));
+        }
+
+        if (results.empty())
+        {
+            std::cout << "No input files." << std::endl;
+            return 1;
+        }
+
+        const auto profile = loadReferenceProfile (referenceFile);
+        if (! profile.isValid)
+        {
+            std::cout << "Could not analyse " << referenceFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        const auto settings = makeSettings (args, profile);
+
+        std::cout << "Reference " << referenceFile.getFileName() << ", " << results.size() << " files, "
+                  << numThreads << " threads, " << blockSize << " samples per block" << std::endl;
+
+        // The results vector is not resized from here on, so jobs can hold references into it.
+        std::atomic<int> numFinished { 0 };
+        juce::WaitableEvent jobFinished;
+        const auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+        {
+            juce::ThreadPool pool (numThreads);
+            for (auto& result : results)
+                pool.addJob (new RenderFileJob (result, profile, settings, blockSize, bitsPerSample, numFinished, jobFinished), true);
+
+            // Woken by every finished job; the timeout only keeps the progress line alive.
+            const int total = static_cast<int> (results.size());
+            while (numFinished.load() < total)
+            {
+                jobFinished.wait (1000);
+                std::cout << "\r" << numFinished.load() << " / " << total << " files" << std::flush;
+            }
+        }
+
+        const auto elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) * 0.001;
+        double totalAudioSeconds = 0.0;
+        int numFailed = 0;
+
+        std::cout << std::endl;
+        for (const auto& result : results)
+        {
+            if (result.error.isNotEmpty())
+            {
+                std::cout << "Could not render " << result.input.getFullPathName() << ": " << result.error << std::endl;
+                ++numFailed;
+                continue;
+            }
+
+            // Realtime factor: seconds of audio rendered per second of wall-clock time on one thread.
+            totalAudioSeconds += result.audioSeconds;
+            std::cout << result.input.getFileName() << ": " << juce::String (result.audioSeconds, 1) << " s in "
+                      << juce::String (result.elapsedSeconds, 2) << " s, "
+                      << juce::String (result.audioSeconds / juce::jmax (1.0e-3, result.elapsedSeconds), 1) << "x realtime" << std::endl;
+        }
+
+        std::cout << "Rendered " << static_cast<int> (results.size()) - numFailed << " files in " << juce::String (elapsedSeconds, 2) << " s, "
+                  << juce::String (totalAudioSeconds / juce::jmax (1.0e-3, elapsedSeconds), 1) << "x realtime overall" << std::endl;
+
+        return numFailed == 0 ? 0 : 1;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    const juce::ArgumentList args (argc, argv);
+    return juce::ConsoleApplication::invokeCatchingFailures ([&args] { return runRenderer (args); });
+}
@@ -0,0 +1,318 @@
+#include <array>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <juce_core/juce_core.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_dsp/juce_dsp.h>
+
+#include "../dsp/ProcessingChain.h"
+#include "../dsp/SpectrumAnalyser.h"
+
+/**
+    Measures the cost of every processing module and of the whole chain across block sizes, sample
+    rates and channel counts, and the throughput of the reference analyser. Results are written as
+    JSON, so runs on different commits or JUCE versions can be compared by a script.
+
+    Module costs are given in nanoseconds per sample frame and per channel sample. "ProcessingChain"
+    is everything processBlock runs after the profilers have been fed, including the dry path.
+
+    Usage: ProcessingBenchmark [--output=results.json] [--seconds=S] [--blocks=16,64,...]
+                               [--rates=44100,...] [--channels=1,2,...] [--modules=EQDesigner,...]
+                               [--analyser-seconds=S] [--no-analyser]
+*/
+namespace
+{
+    using reference_tone_matcher::ProcessingChain;
+    using reference_tone_matcher::SpectrumAnalyser;
+
+    using BlockProcessor = std::function<void (juce::dsp::AudioBlock<float>&)>;
+
+    /** Sets a module up for one configuration and returns the function that processes a block. */
+    using ModuleFactory = std::function<BlockProcessor (const juce::dsp::ProcessSpec& spec)>;
+
+    struct Module
+    {
+        juce::String name;
+        ModuleFactory create;
+    };
+
+    /** A curve that keeps every EQ section busy, like a typical reference match. */
+    std::array<float, 16> makeBenchmarkGainsDb()
+    {
+        std::array<float, 16> gainsDb{};
+        for (size_t band = 0; band < gainsDb.size(); ++band)
+            gainsDb[band] = (band % 2 == 0 ? 3.0f : -2.0f) + 0.25f * static_cast<float> (band);
+
+        return gainsDb;
+    }
+
+    /** Modules run with the plug-in defaults and the EQ with a non-flat curve, so no stage is skipped. */
+    std::vector<Module> makeModules()
+    {
+        std::vector<Module> modules;
+
+        modules.push_back ({ "EQDesigner", [] (const juce::dsp::ProcessSpec& spec) -> BlockProcessor
+        {
+            auto eq = std::make_shared<reference_tone_matcher::EQDesigner>();
+            const auto gainsDb = makeBenchmarkGainsDb();
+            for (size_t band = 0; band < gainsDb.size(); ++band)
+                eq->setBandGain (band, gainsDb[band]);
+
+            eq->prepare (spec);
+            return [eq] (juce::dsp::AudioBlock<float>& block) { eq->process (block); };
+        } });
+
+        modules.push_back ({ "TransientDesigner", [] (const juce::dsp::ProcessSpec& spec) -> BlockProcessor
+        {
+            auto transientDesigner = std::make_shared<reference_tone_matcher::TransientDesigner>();
+            transientDesigner->prepare (spec);
+            transientDesigner->setAmount (0.5f);
+            return [transientDesigner] (juce::dsp::AudioBlock<float>& block) { transientDesigner->process (block); };
+        } });
+
+        modules.push_back ({ "Exciter", [] (const juce::dsp::ProcessSpec& spec) -> BlockProcessor
+        {
+            auto exciter = std::make_shared<reference_tone_matcher::Exciter>();
+            exciter->prepare (spec);
+            exciter->setAmounts (0.5f, 0.5f);
+            return [exciter] (juce::dsp::AudioBlock<float>& block) { exciter->process (block); };
+        } });
+
+        modules.push_back ({ "MultiBandDynamics", [] (const juce::dsp::ProcessSpec& spec) -> BlockProcessor
+        {
+            auto dynamics = std::make_shared<reference_tone_matcher::MultiBandDynamics>();
+            dynamics->prepare (spec);
+            dynamics->setAmount (0.5f);
+            return [dynamics] (juce::dsp::AudioBlock<float>& block) { dynamics->process (block); };
+        } });
+
+        modules.push_back ({ "ProcessingChain", [] (const juce::dsp::ProcessSpec& spec) -> BlockProcessor
+        {
+            auto chain = std::make_shared<ProcessingChain>();
+            ProcessingChain::Settings settings;
+            settings.bandGainsDb = makeBenchmarkGainsDb();
+            chain->setSettings (settings);
+            chain->prepare (spec.sampleRate, static_cast<int> (spec.maximumBlockSize), static_cast<int> (spec.numChannels));
+            return [chain] (juce::dsp::AudioBlock<float>& block) { chain->process (block); };
+        } });
+
+        return modules;
+    }
+
+    /** Noise at a moderate level, long enough that blocks do not repeat every few milliseconds. */
+    juce::AudioBuffer<float> makeNoise (int numChannels, int numSamples)
+    {
+        juce::AudioBuffer<float> noise (numChannels, numSamples);
+        juce::Random random (1234);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            for (int i = 0; i < numSamples; ++i)
+                noise.setSample (ch, i, 0.25f * (2.0f * random.nextFloat() - 1.0f));
+
+        return noise;
+    }
+
+    /** Returns the seconds spent processing the given amount of audio, after a warm-up that lets
+        ramps and fades settle. Each block is refilled from the noise, which adds a copy per block,
+        so the noise must be at least one block long. */
+    double timeModule (const BlockProcessor& process, const juce::AudioBuffer<float>& noise, int blockSize,
+                       juce::int64 numWarmUpSamples, juce::int64 numTimedSamples)
+    {
+        jassert (noise.getNumSamples() >= blockSize);
+        const int numChannels = noise.getNumChannels();
+        const int noiseLength = noise.getNumSamples() - noise.getNumSamples() % blockSize;
+        juce::AudioBuffer<float> buffer (numChannels, blockSize);
+        auto block = juce::dsp::AudioBlock<float> (buffer);
+        int noisePosition = 0;
+
+        auto run = [&] (juce::int64 numSamples)
+        {
+            for (juce::int64 done = 0; done < numSamples; done += blockSize)
+            {
+                for (int ch = 0; ch < numChannels; ++ch)
+                    buffer.copyFrom (ch, 0, noise, ch, noisePosition, blockSize);
+
+                noisePosition = (noisePosition + blockSize) % noiseLength;
+                process (block);
+            }
+        };
+
+        run (numWarmUpSamples);
+
+        const auto startTicks = juce::Time::getHighResolutionTicks();
+        run (numTimedSamples);
+
+        return juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+    }
+
+    /** Times analyseFile on a temporary file with one thread and with every core. */
+    juce::Array<juce::var> benchmarkAnalyser (double audioSeconds)
+    {
+        juce::Array<juce::var> results;
+        constexpr double sampleRate = 48000.0;
+        constexpr int numChannels = 2;
+
+        // Written as 24-bit WAV like most references, so decoding is part of the measurement.
+        juce::TemporaryFile temporaryFile (".wav");
+        {
+            auto stream = temporaryFile.getFile().createOutputStream();
+            if (stream == nullptr)
+                return results;
+
+            std::unique_ptr<juce::AudioFormatWriter> writer (juce::WavAudioFormat().createWriterFor (stream.get(), sampleRate,
+                                                                                                      numChannels, 24, {}, 0));
+            if (writer == nullptr)
+                return results;
+
+            stream.release();
+
+            const auto noise = makeNoise (numChannels, SpectrumAnalyser::chunkSize);
+            const auto totalSamples = static_cast<juce::int64> (audioSeconds * sampleRate);
+            for (juce::int64 written = 0; written < totalSamples; written += noise.getNumSamples())
+                writer->writeFromAudioSampleBuffer (noise, 0, static_cast<int> (juce::jmin (static_cast<juce::int64> (noise.getNumSamples()),
+                                                                                            totalSamples - written)));
+        }
+
+        for (const int numThreads : { 1, juce::SystemStats::getNumCpuCores() })
+        {
+            SpectrumAnalyser analyser;
+            analyser.setNumWorkerThreads (numThreads);
+
+            const auto startTicks = juce::Time::getHighResolutionTicks();
+            const auto profile = analyser.analyseFile (temporaryFile.getFile(), 0.0);
+            const auto elapsedSeconds = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+
+            if (! profile.isValid)
+                continue;
+
+            auto* result = new juce::DynamicObject();
+            result->setProperty ("threads", numThreads);
+            result->setProperty ("sampleRate", sampleRate);
+            result->setProperty ("channels", numChannels);
+            result->setProperty ("audioSeconds", audioSeconds);
+            result->setProperty ("elapsedSeconds", elapsedSeconds);
+            result->setProperty ("audioSecondsPerSecond", audioSeconds / juce::jmax (1.0e-9, elapsedSeconds));
+            results.add (juce::var (result));
+
+            std::cerr << "SpectrumAnalyser, " << numThreads << " threads: "
+                      << juce::String (audioSeconds / juce::jmax (1.0e-9, elapsedSeconds), 1) << " s of audio per s" << std::endl;
+
+            if (numThreads == juce::SystemStats::getNumCpuCores())
+                break;
+        }
+
+        return results;
+    }
+
+    juce::Array<int> parseList (const juce::ArgumentList& args, const juce::String& option, juce::Array<int> defaults)
+    {
+        if (! args.containsOption (option))
+            return defaults;
+
+        juce::Array<int> values;
+        for (const auto& token : juce::StringArray::fromTokens (args.getValueForOption (option), ",", {}))
+            if (token.getIntValue() > 0)
+                values.add (token.getIntValue());
+
+        return values;
+    }
+
+    int runBenchmark (const juce::ArgumentList& args)
+    {
+        const auto blockSizes = parseList (args, "--blocks", { 16, 64, 256, 1024, 4096 });
+        const auto sampleRates = parseList (args, "--rates", { 44100, 48000, 96000, 192000 });
+        const auto channelCounts = parseList (args, "--channels", { 1, 2, 6 });
+        const double seconds = args.containsOption ("--seconds") ? juce::jmax (0.01, args.getValueForOption ("--seconds").getDoubleValue()) : 1.0;
+        const auto moduleFilter = juce::StringArray::fromTokens (args.getValueForOption ("--modules"), ",", {});
+
+        // At least 64k samples, so blocks do not repeat every few milliseconds, and at least one block.
+        int noiseLength = 1 << 16;
+        for (const auto blockSize : blockSizes)
+            noiseLength = juce::jmax (noiseLength, blockSize);
+
+        juce::Array<juce::var> moduleResults;
+
+        for (const auto& module : makeModules())
+        {
+            if (! moduleFilter.isEmpty() && ! moduleFilter.contains (module.name))
+                continue;
+
+            for (const auto numChannels : channelCounts)
+            {
+                for (const auto sampleRate : sampleRates)
+                {
+                    const auto noise = makeNoise (numChannels, noiseLength);
+                    const auto numTimedSamples = static_cast<juce::int64> (seconds * sampleRate);
+
+                    for (const auto blockSize : blockSizes)
+                    {
+                        const juce::dsp::ProcessSpec spec { static_cast<double> (sampleRate), static_cast<juce::uint32> (blockSize),
+                                                            static_cast<juce::uint32> (numChannels) };
+                        const auto process = module.create (spec);
+
+                        const auto roundedSamples = (numTimedSamples + blockSize - 1) / blockSize * blockSize;
+                        const auto elapsedSeconds = timeModule (process, noise, blockSize, sampleRate / 4, roundedSamples);
+                        const auto nsPerSample = elapsedSeconds * 1.0e9 / static_cast<double> (roundedSamples);
+
+                        auto* result = new juce::DynamicObject();
+                        result->setProperty ("module", module.name);
+                        result->setProperty ("sampleRate", sampleRate);
+                        result->setProperty ("blockSize", blockSize);
+                        result->setProperty ("channels", numChannels);
+                        result->setProperty ("nsPerSample", nsPerSample);
+                        result->setProperty ("nsPerChannelSample", nsPerSample / numChannels);
+                        result->setProperty ("realtimeFactor", static_cast<double> (roundedSamples) / sampleRate / juce::jmax (1.0e-9, elapsedSeconds));
+                        moduleResults.add (juce::var (result));
+
+                        std::cerr << module.name << ", " << sampleRate << " Hz, " << numChannels << " ch, block " << blockSize
+                                  << ": " << juce::String (nsPerSample, 2) << " ns/sample" << std::endl;
+                    }
+                }
+            }
+        }
+
+        auto* system = new juce::DynamicObject();
+        system->setProperty ("juce", juce::SystemStats::getJUCEVersion());
+        system->setProperty ("cpu", juce::SystemStats::getCpuModel());
+        system->setProperty ("cores", juce::SystemStats::getNumCpuCores());
+        system->setProperty ("simdLanes", static_cast<int> (juce::dsp::SIMDRegister<float>::size()));
+
+        auto* root = new juce::DynamicObject();
+        root->setProperty ("system", juce::var (system));
+        root->setProperty ("modules", moduleResults);
+
+        if (! args.containsOption ("--no-analyser"))
+        {
+            const double analyserSeconds = args.containsOption ("--analyser-seconds")
+                                               ? juce::jmax (1.0, args.getValueForOption ("--analyser-seconds").getDoubleValue())
+                                               : 120.0;
+            root->setProperty ("analyser", benchmarkAnalyser (analyserSeconds));
+        }
+
+        const auto json = juce::JSON::toString (juce::var (root));
+
+        if (args.containsOption ("--output"))
+        {
+            const auto outputFile = args.getValueForOption ("--output");
+            if (! juce::File::getCurrentWorkingDirectory().getChildFile (outputFile).replaceWithText (json))
+            {
+                std::cerr << "Could not write " << outputFile << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cout << json << std::endl;
+        }
+
+        return 0;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    const juce::ArgumentList args (argc, argv);
+    return juce::ConsoleApplication::invokeCatchingFailures ([&args] { return runBenchmark (args); });
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <juce_core/juce_core.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include "../dsp/SpectrumAnalyser.h"
+#include "../dsp/ProfileIndex.h"
+
+/**
+    Walks a reference library, analyses new or changed files on every core and writes a
+    ProfileIndex that the plug-in can search.
+
+    Usage: ReferenceLibraryIndexer <libraryDirectory> <indexFile.rtpi> [--threads=N] [--full]
+*/
+namespace
+{
+    using reference_tone_matcher::ProfileIndex;
+    using reference_tone_matcher::SpectrumAnalyser;
+
+    // Matched with File::hasFileExtension, which ignores case, so "*.WAV" files are found on Linux too.
+    constexpr const char* audioFileExtensions = "wav;flac;mp3;aif;aiff";
+
+    /** Analyses one file on a pool thread and stores the result in its slot of the index. */
+    class AnalyseFileJob : public juce::ThreadPoolJob
+    {
+    public:
+        AnalyseFileJob (ProfileIndex::Entry& entryToFill, std::atomic<int>& finishedCounter, juce::WaitableEvent& finishedEvent)
+            : juce::ThreadPoolJob ("Analyse " + entryToFill.path),
+              entry (entryToFill),
+              numFinished (finishedCounter),
+              jobFinished (finishedEvent)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            // Files are analysed in parallel, so each analysis stays on its own thread.
+            SpectrumAnalyser analyser;
+            analyser.setNumWorkerThreads (1);
+
+            const juce::File file (entry.path);
+            entry.profile = analyser.analyseFile (file, 0.0, [this] (double) { return ! shouldExit(); });
+            ++numFinished;
+            jobFinished.signal();
+
+            return jobHasFinished;
+        }
+
+    private:
+        ProfileIndex::Entry& entry;
+        std::atomic<int>& numFinished;
+        juce::WaitableEvent& jobFinished;
+    };
+
+    int runIndexer (const juce::ArgumentList& args)
+    {
+        if (args.size() < 2)
+        {
+            std::cout << "Usage: ReferenceLibraryIndexer <libraryDirectory> <indexFile.rtpi> [--threads=N] [--full]" << std::endl;
+            return 1;
+        }
+
+        const auto libraryDirectory = args[0].resolveAsExistingFolder();
+        const auto indexFile = args[1].resolveAsFile();
+        const int numThreads = args.containsOption ("--threads") ? juce::jmax (1, args.getValueForOption ("--threads").getIntValue())
+                                                                 : juce::SystemStats::getNumCpuCores();
+
+        SpectrumAnalyser settingsAnalyser;
+        settingsAnalyser.setNumWorkerThreads (1);
+        const auto settingsHash = settingsAnalyser.getSettingsHash (0.0);
+
+        ProfileIndex previousIndex;
+        if (! args.containsOption ("--full") && previousIndex.load (indexFile)
+            && previousIndex.getSettingsHash() != settingsHash)
+        {
+            std::cout << "Analysis settings changed, re-analysing the whole library." << std::endl;
+            previousIndex.getEntries().clear();
+        }
+
+        std::map<juce::String, const ProfileIndex::Entry*> previousEntries;
+        for (const auto& entry : previousIndex.getEntries())
+            previousEntries[entry.path] = &entry;
+
+        ProfileIndex index;
+        index.setSettingsHash (settingsHash);
+        auto& entries = index.getEntries();
+        std::vector<size_t> entriesToAnalyse;
+
+        for (const auto& item : juce::RangedDirectoryIterator (libraryDirectory, true, "*", juce::File::findFiles))
+        {
+            const auto file = item.getFile();
+            if (! file.hasFileExtension (audioFileExtensions))
+                continue;
+
+            const auto path = file.getFullPathName();
+            const auto previous = previousEntries.find (path);
+
+            if (previous != previousEntries.end() && ProfileIndex::isUpToDate (*previous->second, file))
+            {
+                entries.push_back (*previous->second);
+                continue;
+            }
+
+            ProfileIndex::Entry entry;
+            entry.path = path;
+            entry.fileSize = static_cast<juce::uint64> (file.getSize());
+            entry.modificationTime = file.getLastModificationTime().toMilliseconds();
+            entriesToAnalyse.push_back (entries.size());
+            entries.push_back (std::move (entry));
+        }
+
+        std::cout << entries.size() << " files found, " << entriesToAnalyse.size() << " new or changed, "
+                  << numThreads << " threads" << std::endl;
+
+        // The entries vector is not resized from here on, so jobs can hold references into it.
+        std::atomic<int> numFinished { 0 };
+        juce::WaitableEvent jobFinished;
+        const auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+        {
+            juce::ThreadPool pool (numThreads);
+            for (const auto entryIndex : entriesToAnalyse)
+                pool.addJob (new AnalyseFileJob (entries[entryIndex], numFinished, jobFinished), true);
+
+            // Woken by every finished job; the timeout only keeps the progress line alive.
+            const int total = static_cast<int> (entriesToAnalyse.size());
+            while (numFinished.load() < total)
+            {
+                jobFinished.wait (1000);
+                const auto seconds = (juce::Time::getMillisecondCounterHiRes() - startTime) * 0.001;
+                const int done = numFinished.load();
+                std::cout << "\r" << done << " / " << total << " files, "
+                          << juce::String (done / juce::jmax (1.0e-3, seconds), 2) << " files/s" << std::flush;
+            }
+        }
+
+        const auto elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) * 0.001;
+
+        int numFailed = 0;
+        for (const auto entryIndex : entriesToAnalyse)
+        {
+            if (! entries[entryIndex].profile.isValid)
+            {
+                std::cout << std::endl << "Could not analyse " << entries[entryIndex].path;
+                ++numFailed;
+            }
+        }
+
+        entries.erase (std::remove_if (entries.begin(), entries.end(), [] (const ProfileIndex::Entry& entry) { return ! entry.profile.isValid; }),
+                       entries.end());
+
+        if (! index.save (indexFile))
+        {
+            std::cout << std::endl << "Could not write " << indexFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        const auto numAnalysed = static_cast<int> (entriesToAnalyse.size()) - numFailed;
+        std::cout << std::endl
+                  << "Analysed " << numAnalysed << " files in " << juce::String (elapsedSeconds, 2) << " s ("
+                  << juce::String (numAnalysed / juce::jmax (1.0e-3, elapsedSeconds), 2) << " files/s), "
+                  << entries.size() << " profiles in " << indexFile.getFullPathName() << std::endl;
+
+        return 0;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    const juce::ArgumentList args (argc, argv);
+    return juce::ConsoleApplication::invokeCatchingFailures ([&args] { return runIndexer (args); });
+}